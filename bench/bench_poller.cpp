@@ -0,0 +1,151 @@
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "network/epoll_poller.h"
+#include "network/io_uring_poller.h"
+#include "network/looper.h"
+
+using namespace light::network;
+
+// echo workload over unix socket pairs, one thread driving the poller
+// directly: every client sends a message, the server side echoes it and the
+// client sends the next one once the echo is back.
+// usage: bench_poller [connections] [round trips]
+
+namespace {
+
+const size_t MESSAGE_SIZE = 64;
+
+struct Result {
+  double ms;
+  int round_trips;
+};
+
+struct Pair {
+  int client;
+  int server;
+  std::unique_ptr<Dispatcher> client_disp;
+  std::unique_ptr<Dispatcher> server_disp;
+};
+
+Result run(Looper &looper, Poller &poller, int connections, int round_trips) {
+  std::vector<Pair> pairs(connections);
+  char message[MESSAGE_SIZE];
+  memset(message, 'x', sizeof message);
+  int done = 0, sent = 0;
+
+  for (auto &pair : pairs) {
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) != 0) {
+      perror("socketpair");
+      exit(1);
+    }
+    pair.client = fds[0];
+    pair.server = fds[1];
+    pair.client_disp.reset(new Dispatcher(looper, pair.client));
+    pair.server_disp.reset(new Dispatcher(looper, pair.server));
+    Pair *p = &pair;
+    p->server_disp->set_read_callback([p] {
+      char buf[MESSAGE_SIZE];
+      ssize_t n = ::read(p->server, buf, sizeof buf);
+      if (n > 0 && ::write(p->server, buf, n) != n)
+        perror("write");
+    });
+    p->client_disp->set_read_callback([p, &done, &sent, &message,
+                                       round_trips] {
+      char buf[MESSAGE_SIZE];
+      if (::read(p->client, buf, sizeof buf) <= 0)
+        return;
+      ++done;
+      if (sent < round_trips) {
+        ++sent;
+        if (::write(p->client, message, sizeof message) < 0)
+          perror("write");
+      }
+    });
+    pair.client_disp->enable_read();
+    pair.server_disp->enable_read();
+    poller.add_dispatcher(*pair.client_disp);
+    poller.add_dispatcher(*pair.server_disp);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto &pair : pairs) {
+    if (sent < round_trips) {
+      ++sent;
+      if (::write(pair.client, message, sizeof message) < 0)
+        perror("write");
+    }
+  }
+  std::vector<Dispatcher *> active;
+  while (done < round_trips) {
+    active.clear();
+    if (poller.poll(1000, active)) {
+      perror("poll");
+      exit(1);
+    }
+    for (Dispatcher *dispatcher : active) {
+      dispatcher->handle_events();
+    }
+  }
+  Result result = {std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count(),
+                   done};
+
+  for (auto &pair : pairs) {
+    poller.remove_dispatcher(*pair.client_disp);
+    poller.remove_dispatcher(*pair.server_disp);
+    pair.client_disp.reset();
+    pair.server_disp.reset();
+    ::close(pair.client);
+    ::close(pair.server);
+  }
+  return result;
+}
+
+void report(const char *name, const Result &result) {
+  printf("%-9s %8.1f ms  %10.0f round trips/s\n", name, result.ms,
+         result.round_trips / result.ms * 1000);
+}
+
+} /* anonymous */
+
+int main(int argc, char **argv) {
+  int connections = argc > 1 ? atoi(argv[1]) : 64;
+  int round_trips = argc > 2 ? atoi(argv[2]) : 200000;
+  if (connections <= 0)
+    connections = 1;
+  if (round_trips <= 0)
+    round_trips = 1;
+
+  Looper looper;
+  printf("connections=%d round trips=%d message=%d bytes\n", connections,
+         round_trips, static_cast<int>(MESSAGE_SIZE));
+
+#ifdef HAVE_EPOLL_H
+  {
+    EpollPoller poller(looper);
+    report("epoll", run(looper, poller, connections, round_trips));
+  }
+#endif
+#ifdef HAVE_IO_URING
+  try {
+    IoUringPoller poller(looper);
+    Result result = run(looper, poller, connections, round_trips);
+    report("io_uring", result);
+    printf("io_uring_enter calls per round trip: %.2f\n",
+           double(poller.enter_count()) / result.round_trips);
+  } catch (const light::exception::EventException &) {
+    printf("io_uring unavailable on this kernel\n");
+  }
+#else
+  printf("built without io_uring\n");
+#endif
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+#include "network/looper.h"
+
+using namespace light::network;
+
+// compares the slice scheduler with the work stealing scheduler behind
+// Looper::post, usage: bench_scheduler [threads] [tasks]
+
+namespace {
+
+const char *scheduler_name(SchedulerType type) {
+  return type == SLICE_SCHEDULER ? "slice" : "work-stealing";
+}
+
+void spin(int n) {
+  volatile int x = 0;
+  for (int i = 0; i < n; ++i) {
+    x = x + i;
+  }
+}
+
+struct Result {
+  double ms;
+  int tasks;
+};
+
+struct Run {
+  Run(SchedulerType type, int threads) : looper(type), done(0) {
+    for (int i = 0; i < threads; ++i) {
+      workers.emplace_back([this] { looper.loop(); });
+    }
+  }
+
+  ~Run() {
+    looper.stop();
+    for (auto &thd : workers) {
+      thd.join();
+    }
+  }
+
+  void wait(int expect) {
+    while (done.load() < expect) {
+      std::this_thread::yield();
+    }
+  }
+
+  Looper looper;
+  std::atomic_int done;
+  std::vector<std::thread> workers;
+};
+
+// every task is posted from a thread outside the looper
+Result bench_external(SchedulerType type, int threads, int tasks) {
+  Run run(type, threads);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < tasks; ++i) {
+    run.looper.post([&run] {
+      spin(200);
+      run.done.fetch_add(1);
+    });
+  }
+  run.wait(tasks);
+  Result result = {std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count(),
+                   tasks};
+  return result;
+}
+
+// a few seed tasks fan out into a tree, children are posted by workers
+void fan_out(Run &run, int depth) {
+  spin(200);
+  run.done.fetch_add(1);
+  if (depth == 0)
+    return;
+  for (int i = 0; i < 2; ++i) {
+    run.looper.post([&run, depth] { fan_out(run, depth - 1); });
+  }
+}
+
+Result bench_fan_out(SchedulerType type, int threads, int tasks) {
+  int depth = 0;
+  while ((2 << depth) - 1 < tasks / threads) {
+    ++depth;
+  }
+  int expect = threads * ((2 << depth) - 1);
+  Run run(type, threads);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < threads; ++i) {
+    run.looper.post([&run, depth] { fan_out(run, depth); });
+  }
+  run.wait(expect);
+  Result result = {std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count(),
+                   expect};
+  return result;
+}
+
+} /* anonymous */
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? atoi(argv[1])
+                         : static_cast<int>(std::thread::hardware_concurrency());
+  int tasks = argc > 2 ? atoi(argv[2]) : 1000000;
+  if (threads <= 0)
+    threads = 1;
+
+  printf("threads=%d tasks=%d\n", threads, tasks);
+  for (auto type : {SLICE_SCHEDULER, WORK_STEALING_SCHEDULER}) {
+    Result external = bench_external(type, threads, tasks);
+    Result fan = bench_fan_out(type, threads, tasks);
+    printf("%-14s external: %8.1f ms (%6.2f Mops/s)  fan-out: %8.1f ms "
+           "(%6.2f Mops/s)\n",
+           scheduler_name(type), external.ms,
+           external.tasks / external.ms / 1000, fan.ms,
+           fan.tasks / fan.ms / 1000);
+  }
+  return 0;
+}
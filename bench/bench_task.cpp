@@ -0,0 +1,158 @@
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include "core/message_queue.h"
+#include "core/service.h"
+#include "network/looper.h"
+#include "service/network_service.h"
+#include "utils/lockfree_queue.h"
+
+using namespace light::network;
+
+// counts the heap allocations behind one Service::post of
+// NetworkService::send_common_packet, std::function + std::bind against
+// light::utils::Task, usage: bench_task [calls]
+
+namespace {
+std::atomic<uint64_t> allocations(0);
+} /* anonymous */
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  void *p = malloc(size ? size : 1);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+namespace {
+
+char payload[100];
+
+// same signature as NetworkService::send_common_packet, without the sockets
+class SinkService : public light::core::Service {
+public:
+  SinkService(Looper &looper, light::core::MessageQueue &mq)
+      : Service(looper, mq), done(0) {}
+
+  std::error_code init() { return LS_OK_ERROR(); }
+
+  std::error_code fini() { return LS_OK_ERROR(); }
+
+  void send_common_packet(light::service::CommonPacket packet, bool reliable,
+                          int channel) {
+    UNUSED(reliable);
+    UNUSED(channel);
+    packet.destroy();
+    done.fetch_add(1, std::memory_order_release);
+  }
+
+  std::atomic_int done;
+};
+
+light::service::CommonPacket make_packet() {
+  light::service::CommonPacket packet;
+  packet.handle = 1;
+  packet.data = payload;
+  packet.size = sizeof payload;
+  packet.destroy = [] {};
+  return packet;
+}
+
+struct Result {
+  double ms;
+  double allocations;
+};
+
+// what Service::post did before: bind into a std::function and queue it
+Result bench_function(SinkService &svc, int calls) {
+  light::utils::LockFreeQueue<std::function<void()>> queue;
+  std::function<void()> func;
+  uint64_t before = allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; ++i) {
+    queue.push_back(std::function<void()>(
+        std::bind(&SinkService::send_common_packet, &svc, make_packet(), true,
+                  0)));
+    queue.pop_front(func);
+    func();
+  }
+  Result result = {std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count(),
+                   double(allocations.load() - before) / calls};
+  return result;
+}
+
+Result bench_task(SinkService &svc, int calls) {
+  light::utils::LockFreeQueue<light::utils::Task> queue;
+  light::utils::Task task;
+  uint64_t before = allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; ++i) {
+    queue.push_back(light::utils::make_task(&SinkService::send_common_packet,
+                                            &svc, make_packet(), true, 0));
+    queue.pop_front(task);
+    task();
+  }
+  Result result = {std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count(),
+                   double(allocations.load() - before) / calls};
+  return result;
+}
+
+// the real path: Service::post onto the service strand of a running looper
+Result bench_service_post(SinkService &svc, int calls) {
+  int base = svc.done.load();
+  uint64_t before = allocations.load();
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < calls; ++i) {
+    svc.post<SinkService>(&SinkService::send_common_packet, make_packet(),
+                          true, 0);
+  }
+  while (svc.done.load(std::memory_order_acquire) - base < calls) {
+    std::this_thread::yield();
+  }
+  Result result = {std::chrono::duration<double, std::milli>(
+                       std::chrono::steady_clock::now() - start)
+                       .count(),
+                   double(allocations.load() - before) / calls};
+  return result;
+}
+
+} /* anonymous */
+
+int main(int argc, char **argv) {
+  int calls = argc > 1 ? atoi(argv[1]) : 1000000;
+  if (calls <= 0)
+    calls = 1;
+
+  Looper looper;
+  light::core::MessageQueue mq;
+  SinkService svc(looper, mq);
+  svc.set_id(1);
+  std::thread worker([&looper] { looper.loop(); });
+
+  printf("calls=%d, Task inline size %d bytes\n", calls,
+         static_cast<int>(light::utils::Task::INLINE_SIZE));
+  Result func = bench_function(svc, calls);
+  Result task = bench_task(svc, calls);
+  Result post = bench_service_post(svc, calls);
+  printf("std::function+bind: %8.1f ms  %.2f allocations/call\n", func.ms,
+         func.allocations);
+  printf("Task:               %8.1f ms  %.2f allocations/call\n", task.ms,
+         task.allocations);
+  printf("Service::post:      %8.1f ms  %.2f allocations/call\n", post.ms,
+         post.allocations);
+
+  looper.stop();
+  worker.join();
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "network/timer.h"
+
+using namespace light::network;
+
+// per-session timeouts: every session holds a timer that is cancelled and
+// added again on activity, the clock advances one millisecond at a time.
+// "rearms" counts how often the earliest expiry moved, each one would be a
+// timerfd_settime in the looper.
+// usage: bench_timer [sessions] [resets] [slack us]
+
+namespace {
+
+double elapsed_ns(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} /* anonymous */
+
+int main(int argc, char **argv) {
+  int sessions = argc > 1 ? atoi(argv[1]) : 1000000;
+  int resets = argc > 2 ? atoi(argv[2]) : 2000000;
+  Timestamp slack = argc > 3 ? strtoull(argv[3], nullptr, 10) : 0;
+  if (sessions <= 0)
+    sessions = 1;
+  if (resets < 0)
+    resets = 0;
+
+  TimerQueue queue;
+  std::mt19937 rng(1);
+  std::vector<TimerId> timers(sessions);
+  bool need_update;
+  uint64_t expired = 0, rearms = 0;
+  Timestamp armed = 0;
+  Timestamp now = light::utils::get_monotonic_timestamp();
+  auto timeout = [&rng] { return 1000000 + rng() % 59000000; };
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < sessions; ++i) {
+    timers[i] = queue.add_timer_at(now + timeout(), 0, need_update,
+                                   [&expired] { ++expired; }, slack);
+  }
+  double add_ns = elapsed_ns(start) / sessions;
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < resets; ++i) {
+    int session = rng() % sessions;
+    queue.del_timer(timers[session], need_update);
+    timers[session] = queue.add_timer_at(
+        now + timeout(), 0, need_update, [&expired] { ++expired; }, slack);
+  }
+  double reset_ns = resets ? elapsed_ns(start) / resets : 0;
+
+  // a minute of one millisecond ticks, every timer expires
+  const int ticks = 60000;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < ticks; ++i) {
+    now += 1000;
+    queue.update_time(now);
+    Timestamp next = queue.next_expiry();
+    if (next != armed) {
+      armed = next;
+      ++rearms;
+    }
+  }
+  double tick_ns = elapsed_ns(start) / ticks;
+
+  printf("sessions=%d resets=%d slack=%llu us\n", sessions, resets,
+         static_cast<unsigned long long>(slack));
+  printf("add          %8.1f ns\n", add_ns);
+  printf("cancel+add   %8.1f ns\n", reset_ns);
+  printf("tick         %8.1f ns  (%llu expired)\n", tick_ns,
+         static_cast<unsigned long long>(expired));
+  printf("rearms       %8llu\n", static_cast<unsigned long long>(rearms));
+  return 0;
+}
@@ -46,6 +46,20 @@ CHECK_INCLUDE_FILES(sys/epoll.h HAVE_EPOLL_H)
 CHECK_INCLUDE_FILES(sys/timerfd.h HAVE_TIMERFD)
 CHECK_INCLUDE_FILES(sys/eventfd.h HAVE_EVENTFD)
 CHECK_INCLUDE_FILES(sys/event.h HAVE_KQUEUE_H)
+IF (io_uring)
+	CHECK_C_SOURCE_COMPILES (
+		"#include <linux/io_uring.h>
+		#include <sys/syscall.h>
+		#include <unistd.h>
+		int main()
+		{
+		struct io_uring_getevents_arg arg;
+		arg.ts = 0;
+		return (int)syscall(SYS_io_uring_setup, 0, 0) + IORING_FEAT_EXT_ARG;
+		}"
+		HAVE_IO_URING
+		)
+ENDIF()
 CHECK_INCLUDE_FILES(sys/types.h HAVE_SYS_TYPES_H)
 CHECK_INCLUDE_FILES(netdb.h HAVE_NETDB_H)
 
@@ -58,4 +72,20 @@ CHECK_INCLUDE_FILES(sys/time.h HAVE_SYS_TIME_H)
 CHECK_INCLUDE_FILES(WinSock2.h HAVE_WIN_SOCK2_H)
 CHECK_INCLUDE_FILES(sys/socket.h HAVE_SYS_SOCKET_H)
 CHECK_INCLUDE_FILES(WS2tcpip.h HAVE_WS2_TCPIP_H)
+
+CHECK_CXX_SOURCE_COMPILES (
+	"#include <pthread.h>
+	#include <sched.h>
+	int main()
+	{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	return pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+	}"
+	HAVE_PTHREAD_SETAFFINITY
+	)
+CHECK_INCLUDE_FILES(linux/mempolicy.h HAVE_LINUX_MEMPOLICY_H)
+IF (HAVE_LINUX_MEMPOLICY_H)
+	CHECK_SYMBOL_EXISTS(SYS_set_mempolicy "sys/syscall.h" HAVE_SET_MEMPOLICY)
+ENDIF()
 CONFIGURE_FILE (${CMAKE_SOURCE_DIR}/src/config.h.in ${CMAKE_BINARY_DIR}/deps/include/config.h)
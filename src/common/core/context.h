@@ -9,8 +9,13 @@ class Service;
 
 class Context final : public light::utils::NonCopyable {
 public:
-  Context()
-      : looper_(new light::network::Looper), mq_(new light::core::MessageQueue),
+  /**
+   * @param scheduler_type scheduler of the shared looper, every service
+   * built on the context without its own threads posts through it
+   */
+  explicit Context(light::network::SchedulerType scheduler_type =
+                       light::network::SLICE_SCHEDULER)
+      : looper_(new light::network::Looper(scheduler_type)), mq_(new light::core::MessageQueue),
         last_handler_id_(1000), last_service_id_(5000) {}
 
 	~Context ();
@@ -30,16 +30,40 @@ public:
   virtual std::error_code init() = 0;
   virtual std::error_code fini() = 0;
 
+  /**
+   * @return queue_full if the service strand is bounded and refused the post
+   */
+  template <typename CLASS, typename FUNC, typename... ARGS>
+  std::error_code post(FUNC func, ARGS &&... args) {
+    if (strand_) {
+      return get_looper().strand_post(*strand_, func,
+                                      static_cast<CLASS *>(this),
+                                      std::forward<ARGS>(args)...);
+    }
+    return get_looper().post(func, static_cast<CLASS *>(this),
+                             std::forward<ARGS>(args)...);
+  }
+
+  /**
+   * @brief post() past the capacity limits and never dropped, for work that
+   * must not be shed, see Looper::post_unbounded()
+   */
   template <typename CLASS, typename FUNC, typename... ARGS>
-  void post(FUNC func, ARGS &&... args) {
-    get_looper().strand_post(service_id_, std::bind(func, static_cast<CLASS *>(this),
-                                std::forward<ARGS>(args)...));
+  void post_unbounded(FUNC func, ARGS &&... args) {
+    if (strand_) {
+      get_looper().strand_post_unbounded(*strand_, func,
+                                         static_cast<CLASS *>(this),
+                                         std::forward<ARGS>(args)...);
+      return;
+    }
+    get_looper().post_unbounded(func, static_cast<CLASS *>(this),
+                                std::forward<ARGS>(args)...);
   }
 
   template <typename CLASS, typename FUNC, typename RET, typename... ARGS>
   light::network::SafeCallWrapper<RET> wrap(FUNC func, ARGS &&... args) {
-    return get_looper().strand_wrap(service_id_, std::bind(func, static_cast<CLASS *>(this),
-                                       std::forward<ARGS>(args)...));
+    return get_looper().strand_wrap(std::bind(func, static_cast<CLASS *>(this),
+                                       std::forward<ARGS>(args)...), service_id_);
   }
 
   light::core::MessageQueue &get_mq() { return *mq_; }
@@ -48,12 +72,15 @@ public:
 
   void set_id(int service_id) {
     service_id_ = service_id;
+    // the strand lives as long as the looper, keep it to skip the lookup
+    strand_ = service_id ? &looper_->get_strand(service_id) : nullptr;
   }
 
 protected:
   light::network::Looper *looper_;
   light::core::MessageQueue *mq_;
   int service_id_ = 0;
+  light::network::Strand *strand_ = nullptr;
 };
 
 } /* core */
@@ -1,5 +1,7 @@
 #include "config.h"
+#include <algorithm>
 #include <assert.h>
+#include <string.h>
 #include <vector>
 #include <deque>
 #ifdef HAVE_SYS_UIO_H
@@ -58,6 +60,97 @@ void WriteBuffer::shift(size_t len) {
   write_queue_.begin()->write_ptr += len - removed_len;
   size_ -= len;
 }
+
+ReadBuffer::ReadBuffer(size_t initial_capacity)
+    : buf_(), initial_capacity_(initial_capacity), head_(0),
+      size_(0), high_water_(0) {}
+
+int ReadBuffer::prepare(struct iovec *iov, size_t min_free) {
+  if (capacity() - size_ < min_free)
+    grow(size_ + min_free);
+  size_t tail = head_ + size_;
+  if (tail >= capacity()) {
+    // the data wraps, the free space is the gap in the middle
+    tail -= capacity();
+    iov[0].iov_base = &buf_[tail];
+    iov[0].iov_len = head_ - tail;
+    return 1;
+  }
+  iov[0].iov_base = &buf_[tail];
+  iov[0].iov_len = capacity() - tail;
+  if (!head_)
+    return 1;
+  iov[1].iov_base = &buf_[0];
+  iov[1].iov_len = head_;
+  return 2;
+}
+
+void ReadBuffer::commit(size_t len) {
+  assert(size_ + len <= capacity());
+  size_ += len;
+  high_water_ = (std::max)(high_water_, size_);
+}
+
+int ReadBuffer::data(struct iovec *iov) const {
+  if (!size_)
+    return 0;
+  size_t first = (std::min)(size_, capacity() - head_);
+  iov[0].iov_base = const_cast<char *>(&buf_[head_]);
+  iov[0].iov_len = first;
+  if (first == size_)
+    return 1;
+  iov[1].iov_base = const_cast<char *>(&buf_[0]);
+  iov[1].iov_len = size_ - first;
+  return 2;
+}
+
+const char *ReadBuffer::peek(size_t len) {
+  assert(len <= size_);
+  if (head_ + len > capacity()) {
+    // one rotation puts the whole data in front, in order
+    std::rotate(buf_.begin(), buf_.begin() + head_, buf_.end());
+    head_ = 0;
+  }
+  return &buf_[head_];
+}
+
+void ReadBuffer::consume(size_t len) {
+  assert(len <= size_);
+  size_ -= len;
+  head_ += len;
+  if (head_ >= capacity())
+    head_ -= capacity();
+  // an empty ring starts over, the next read gets one segment
+  if (!size_)
+    head_ = 0;
+}
+
+void ReadBuffer::trim() {
+  if (!size_ && capacity() > initial_capacity_ &&
+      high_water_ <= capacity() / 4) {
+    std::vector<char>(initial_capacity_).swap(buf_);
+    head_ = 0;
+  }
+  high_water_ = size_;
+}
+
+void ReadBuffer::grow(size_t min_capacity) {
+  size_t new_capacity =
+      capacity() ? capacity() : (std::max)(initial_capacity_, size_t(1));
+  while (new_capacity < min_capacity) {
+    new_capacity *= 2;
+  }
+  std::vector<char> buf(new_capacity);
+  struct iovec iov[2];
+  int count = data(iov);
+  size_t offset = 0;
+  for (int i = 0; i < count; ++i) {
+    ::memcpy(&buf[offset], iov[i].iov_base, iov[i].iov_len);
+    offset += iov[i].iov_len;
+  }
+  buf_.swap(buf);
+  head_ = 0;
+}
 } /* network */
 
 } /* light */
@@ -1,8 +1,13 @@
 #pragma once
+#include "config.h"
+#include <deque>
 #include <functional>
 #include <memory>
 #include <stdint.h>
 #include <vector>
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
 #include "utils/platform.h"
 
 namespace light {
@@ -38,10 +43,77 @@ private:
   std::vector<struct iovec> write_vect_;
 };
 
+/**
+ * @brief growable ring the received data of a connection lands in. The
+ * free space is at most two segments, prepare() hands them out so a single
+ * readv() fills both. Consumers look at the data in place and consume() what
+ * they used, so a consumer that frames the stream consumes whole frames only
+ * and a partial one stays for the next read. One that passes raw bytes on
+ * reads into its own chunks instead, see TcpConnection::start_reading().
+ * Nothing is allocated before the first prepare().
+ */
+class ReadBuffer {
+public:
+  explicit ReadBuffer(size_t initial_capacity = 16384);
+
+  inline bool empty() const { return size_ == 0; }
+  inline size_t size() const { return size_; }
+  inline size_t capacity() const { return buf_.size(); }
+
+  /**
+   * @brief the free space as iov[0] and maybe iov[1], grown first if less
+   * than min_free bytes are left
+   *
+   * @return the number of segments
+   */
+  int prepare(struct iovec *iov, size_t min_free);
+
+  /**
+   * @brief len bytes were written into the segments of prepare()
+   */
+  void commit(size_t len);
+
+  /**
+   * @brief the data in order as iov[0] and maybe iov[1], nothing is copied
+   *
+   * @return the number of segments, 0 when empty
+   */
+  int data(struct iovec *iov) const;
+
+  /**
+   * @brief the first len bytes in one piece, len <= size(). The data is
+   * moved only when those bytes wrap around the end of the ring. Valid
+   * until the next call that changes the buffer.
+   */
+  const char *peek(size_t len);
+
+  void consume(size_t len);
+
+  /**
+   * @brief call it when the connection goes quiet: an empty ring that was
+   * never more than a quarter full since the last trim() goes back to the
+   * initial capacity
+   */
+  void trim();
+
+private:
+  void grow(size_t min_capacity);
+
+  std::vector<char> buf_;
+  size_t initial_capacity_;
+  // where the data starts
+  size_t head_;
+  size_t size_;
+  // most data held since the last trim()
+  size_t high_water_;
+};
+
 class Connection : public std::enable_shared_from_this<Connection> {
 public:
   Connection(Looper &looper) : looper_(&looper) {}
 
+  Looper &get_looper() const { return *looper_; }
+
 protected:
   Looper *looper_;
 };
@@ -0,0 +1,157 @@
+#include <utility>
+#include <vector>
+#include "network/deadlines.h"
+#include "network/looper.h"
+namespace light {
+namespace network {
+
+Deadlines::Entry::Entry()
+    : nodes_(), member_(), owner_(nullptr), callback_() {
+  for (auto &node : nodes_) {
+    node.entry = this;
+  }
+  member_.entry = this;
+}
+
+Deadlines::Entry::~Entry() {
+  if (owner_)
+    owner_->detach(*this);
+}
+
+Deadlines::Deadlines(Looper &looper, Timestamp slack)
+    : looper_(looper), slack_(slack), timeouts_(), lists_(), entries_(),
+      count_(0), timer_id_(0), armed_(0), lock_() {}
+
+Deadlines::~Deadlines() {
+  lock_guard_t lk(lock_);
+  while (entries_.linked()) {
+    Entry *entry = entries_.next->entry;
+    for (auto &node : entry->nodes_) {
+      node.unlink();
+    }
+    entry->member_.unlink();
+    entry->owner_ = nullptr;
+  }
+  count_ = 0;
+  if (timer_id_) {
+    std::error_code ec;
+    looper_.cancel_timer(ec, timer_id_);
+  }
+}
+
+void Deadlines::set_timeout(Type type, Timestamp timeout) {
+  lock_guard_t lk(lock_);
+  timeouts_[type] = timeout;
+}
+
+void Deadlines::attach(Entry &entry, const callback_t &callback) {
+  if (entry.owner_ && entry.owner_ != this)
+    entry.owner_->detach(entry);
+  lock_guard_t lk(lock_);
+  entry.callback_ = callback;
+  if (entry.owner_)
+    return;
+  entry.owner_ = this;
+  entries_.push_back(entry.member_);
+}
+
+void Deadlines::detach(Entry &entry) {
+  lock_guard_t lk(lock_);
+  if (entry.owner_ != this)
+    return;
+  for (int type = 0; type < TYPE_COUNT; ++type) {
+    stop_locked(entry, static_cast<Type>(type));
+  }
+  entry.member_.unlink();
+  entry.owner_ = nullptr;
+  entry.callback_ = nullptr;
+}
+
+void Deadlines::refresh(Entry &entry, Type type) {
+  lock_guard_t lk(lock_);
+  if (entry.owner_ != this || !timeouts_[type])
+    return;
+  Entry::Node &node = entry.nodes_[type];
+  if (node.linked())
+    node.unlink();
+  else
+    ++count_;
+  node.deadline = looper_.now() + timeouts_[type];
+  lists_[type].push_back(node);
+  // the earlier deadlines in the list are waited for already
+  if (lists_[type].next == &node)
+    arm(node.deadline);
+}
+
+void Deadlines::stop(Entry &entry, Type type) {
+  lock_guard_t lk(lock_);
+  if (entry.owner_ == this)
+    stop_locked(entry, type);
+}
+
+void Deadlines::stop_locked(Entry &entry, Type type) {
+  Entry::Node &node = entry.nodes_[type];
+  if (!node.linked())
+    return;
+  // a stopped head leaves the timer early at worst
+  node.unlink();
+  --count_;
+}
+
+void Deadlines::expire(Timestamp now) {
+  std::vector<std::pair<callback_t, Type>> due;
+  {
+    lock_guard_t lk(lock_);
+    Timestamp next = 0;
+    for (int type = 0; type < TYPE_COUNT; ++type) {
+      Entry::Node &list = lists_[type];
+      while (list.linked() && list.next->deadline <= now) {
+        Entry::Node *node = list.next;
+        node->unlink();
+        --count_;
+        due.emplace_back(node->entry->callback_, static_cast<Type>(type));
+      }
+      if (list.linked() && (!next || list.next->deadline < next))
+        next = list.next->deadline;
+    }
+    if (next)
+      arm(next);
+  }
+  // outside the lock, a callback may refresh or detach any entry
+  for (auto &item : due) {
+    if (item.first)
+      item.first(item.second);
+  }
+}
+
+void Deadlines::arm(Timestamp deadline) {
+  if (timer_id_ && armed_ <= deadline)
+    return;
+  std::error_code ec;
+  if (timer_id_) {
+    looper_.cancel_timer(ec, timer_id_);
+    timer_id_ = 0;
+  }
+  Timestamp now = looper_.now();
+  TimerId timer_id =
+      looper_.add_timer(ec, deadline > now ? deadline - now : 0, 0,
+                        std::bind(&Deadlines::on_timer, this), slack_);
+  if (ec) {
+    LOG(WARNING) << "failed to arm deadline timer: " << ec.message();
+    return;
+  }
+  timer_id_ = timer_id;
+  armed_ = deadline;
+}
+
+void Deadlines::on_timer() {
+  {
+    lock_guard_t lk(lock_);
+    timer_id_ = 0;
+    armed_ = 0;
+  }
+  expire(looper_.now());
+}
+
+} /* network */
+} /* light */
@@ -0,0 +1,160 @@
+#pragma once
+#include <functional>
+#include <mutex>
+#include "network/timer.h"
+#include "utils/noncopyable.h"
+
+namespace light {
+namespace network {
+
+class Looper;
+
+/**
+ * @brief idle, read and write deadlines of the connections of one looper.
+ *
+ * Every type has a single timeout, so a deadline refreshed now is the
+ * latest of its type: each type keeps its running deadlines in a list
+ * ordered by time, a refresh moves the entry to the tail and the earliest
+ * deadline is the head. Refreshing costs no allocation and no timer
+ * operation, one looper timer armed at the earliest head checks the heads
+ * only.
+ */
+class Deadlines : public light::utils::NonCopyable {
+public:
+  enum Type { IDLE, READ, WRITE, TYPE_COUNT };
+
+  typedef std::function<void(Type)> callback_t;
+
+  /**
+   * @brief the deadlines of one connection, usually a member of it. The
+   * destructor detaches it.
+   */
+  class Entry : public light::utils::NonCopyable {
+  public:
+    Entry();
+    ~Entry();
+
+    bool attached() const { return owner_ != nullptr; }
+
+    // the calls of the owner, nothing happens when detached
+    void refresh(Type type) {
+      if (owner_)
+        owner_->refresh(*this, type);
+    }
+
+    void stop(Type type) {
+      if (owner_)
+        owner_->stop(*this, type);
+    }
+
+    void detach() {
+      if (owner_)
+        owner_->detach(*this);
+    }
+
+  private:
+    friend class Deadlines;
+
+    struct Node {
+      Node() : prev(this), next(this), entry(nullptr), deadline(0) {}
+
+      bool linked() const { return next != this; }
+
+      void push_back(Node &node) {
+        node.prev = prev;
+        node.next = this;
+        prev->next = &node;
+        prev = &node;
+      }
+
+      void unlink() {
+        prev->next = next;
+        next->prev = prev;
+        prev = next = this;
+      }
+
+      Node *prev;
+      Node *next;
+      Entry *entry;
+      Timestamp deadline;
+    };
+
+    Node nodes_[TYPE_COUNT];
+    // in the entries_ of the owner
+    Node member_;
+    Deadlines *owner_;
+    callback_t callback_;
+  };
+
+  /**
+   * @param slack how late an expiry may be noticed, see
+   * Looper::add_timer()
+   */
+  explicit Deadlines(Looper &looper, Timestamp slack = 10000);
+
+  /**
+   * @brief detaches the entries still attached
+   */
+  ~Deadlines();
+
+  Looper &get_looper() const { return looper_; }
+
+  /**
+   * @brief microseconds, 0 turns the type off. Set it before the entries
+   * are refreshed, a changed timeout keeps the order of the running ones.
+   */
+  void set_timeout(Type type, Timestamp timeout);
+
+  Timestamp get_timeout(Type type) const { return timeouts_[type]; }
+
+  /**
+   * @param callback called once per deadline that ran out, from the
+   * looper. The deadline is stopped by then, the entry stays attached.
+   */
+  void attach(Entry &entry, const callback_t &callback);
+
+  void detach(Entry &entry);
+
+  /**
+   * @brief start the deadline of type, or push it to timeout from now()
+   */
+  void refresh(Entry &entry, Type type);
+
+  void stop(Entry &entry, Type type);
+
+  bool running(const Entry &entry, Type type) const {
+    return entry.nodes_[type].linked();
+  }
+
+  /**
+   * @brief run the callbacks of the deadlines due at now, the timer does it
+   * with Looper::now()
+   */
+  void expire(Timestamp now);
+
+  size_t size() const { return count_; }
+
+private:
+  typedef std::lock_guard<std::mutex> lock_guard_t;
+
+  void stop_locked(Entry &entry, Type type);
+  // make sure the timer fires by deadline, called with lock_ held
+  void arm(Timestamp deadline);
+  void on_timer();
+
+  Looper &looper_;
+  Timestamp slack_;
+  Timestamp timeouts_[TYPE_COUNT];
+  // list heads, the first node is the earliest deadline
+  Entry::Node lists_[TYPE_COUNT];
+  Entry::Node entries_;
+  size_t count_;
+  TimerId timer_id_;
+  // when the timer fires, 0 if none is pending
+  Timestamp armed_;
+  // a looper may be run by several threads
+  std::mutex lock_;
+};
+
+} /* network */
+} /* light */
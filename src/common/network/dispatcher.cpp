@@ -4,56 +4,135 @@
 namespace light {
 namespace network {
 
+namespace {
+// lets handle_events() find out whether a callback deleted the dispatcher
+struct DestroyGuard {
+  explicit DestroyGuard(bool *&slot) : slot(&slot), destroyed(false) {
+    *this->slot = &destroyed;
+  }
+  ~DestroyGuard() {
+    if (!destroyed)
+      *slot = nullptr;
+  }
+  bool **slot;
+  bool destroyed;
+};
+} /* anonymous */
+
 std::error_code Dispatcher::attach(Looper &looper) {
   if (attached_)
     return LS_OK_ERROR();
   this->looper_ = &looper;
   this->attached_ = true;
-  return looper_->add_dispatcher(*this);
+  std::error_code ec = looper_->add_dispatcher(*this);
+  // the looper may have made it oneshot
+  polled_events_ = poller_events();
+  return ec;
 }
 std::error_code Dispatcher::detach() {
   if (!attached_)
     return LS_OK_ERROR();
+  // a queued update is flushed or dropped once this returns
+  looper_->cancel_update(*this);
   this->attached_ = false;
   return looper_->remove_dispatcher(*this);
 }
 
 std::error_code Dispatcher::reattach() {
   if (attached_) {
-    return looper_->update_dispatcher(*this);
+    // applied by the re-arm after the callbacks
+    if (oneshot_ && handling_.load(std::memory_order_acquire))
+      return LS_OK_ERROR();
+    if (update_list_.load(std::memory_order_relaxed) ||
+        poller_events() == polled_events_)
+      return LS_OK_ERROR();
+    if (looper_->defer_update(*this))
+      return LS_OK_ERROR();
+    return flush_update();
   } else {
     return attach();
   }
 }
 
+std::error_code Dispatcher::flush_update() {
+  update_list_.store(nullptr, std::memory_order_relaxed);
+  if (!attached_ || (oneshot_ && handling_.load(std::memory_order_acquire)))
+    return LS_OK_ERROR();
+  int events = poller_events();
+  // changes that cancelled out within the batch
+  if (events == polled_events_)
+    return LS_OK_ERROR();
+  polled_events_ = events;
+  return looper_->update_dispatcher(*this);
+}
+
 std::error_code Dispatcher::attach() { return attach(*looper_); }
-void Dispatcher::set_poll_event_data(bool r, bool w, bool e, bool c) {
+void Dispatcher::set_poll_event_data(bool r, bool w, bool e, bool c,
+                                     bool h) {
   poll_events_.read = r;
   poll_events_.write = w;
   poll_events_.error = e;
   poll_events_.close = c;
+  poll_events_.half_close = h;
+  if (oneshot_)
+    handling_.store(true, std::memory_order_release);
+}
+
+bool Dispatcher::merge_poll_event_data(uint64_t round, bool r, bool w, bool e,
+                                       bool c, bool h) {
+  if (poll_round_ != round) {
+    poll_round_ = round;
+    set_poll_event_data(r, w, e, c, h);
+    return true;
+  }
+  set_poll_event_data(poll_events_.read || r, poll_events_.write || w,
+                      poll_events_.error || e, poll_events_.close || c,
+                      poll_events_.half_close || h);
+  return false;
 }
 
 void Dispatcher::handle_events() {
-  //ִδֹǰcallbackԺĲи
-  if (poll_events_.read) {
-    if (read_callback_)
-      read_callback_();
-  } else if (poll_events_.close) {
-    if (close_callback_)
-      close_callback_();
-  } else if (poll_events_.error) {
-    if (error_callback_)
-      error_callback_();
-  } else if (poll_events_.write) {
-    if (write_callback_)
-      write_callback_();
+  PollEventData events = poll_events_;
+  bool oneshot = oneshot_;
+  bool attached = attached_;
+  DestroyGuard guard(destroyed_);
+  // neither deleted nor detached by the callbacks run so far
+  auto alive = [this, &guard, attached] {
+    return !guard.destroyed && attached_ == attached;
+  };
+
+  // data first, the output it produces can go out with the write below
+  if (events.read && read_callback_)
+    read_callback_();
+  if (events.half_close && alive() && !half_closed_) {
+    half_closed_ = true;
+    if (half_close_callback_)
+      half_close_callback_();
+  }
+  // the write interest may be gone already, e.g. dropped by a batch that
+  // has not reached the poller yet
+  if (events.write && alive() && writable() && write_callback_)
+    write_callback_();
+  if (events.error && alive() && error_callback_)
+    error_callback_();
+  if (events.close && alive() && close_callback_)
+    close_callback_();
+
+  if (!oneshot || guard.destroyed)
+    return;
+  handling_.store(false, std::memory_order_release);
+  // hand the fd back with whatever interest the callbacks left
+  if (attached_) {
+    polled_events_ = poller_events();
+    looper_->rearm_dispatcher(*this);
   }
 }
 
 const int Dispatcher::NO_EVENT = 0;
 const int Dispatcher::READ_EVENT = (1 << 1);
 const int Dispatcher::WRITE_EVENT(1 << 2);
+const int Dispatcher::EDGE_TRIGGERED_FLAG(1 << 3);
+const int Dispatcher::ONESHOT_FLAG(1 << 4);
 
 } /* network */
 } /* light */
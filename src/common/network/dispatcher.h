@@ -1,5 +1,6 @@
 #pragma once
 #include <assert.h>
+#include <atomic>
 #include <vector>
 #include <memory>
 #include <map>
@@ -17,14 +18,17 @@ namespace light {
 namespace network {
 
 class Looper;
+struct PendingUpdates;
 
 struct PollEventData {
-  PollEventData(bool r, bool w, bool e, bool c)
-      : read(r), write(w), error(e), close(c) {}
+  PollEventData(bool r, bool w, bool e, bool c, bool h)
+      : read(r), write(w), error(e), close(c), half_close(h) {}
   bool read;
   bool write;
   bool error;
   bool close;
+  // the peer shut down its sending side (EPOLLRDHUP)
+  bool half_close;
 };
 
 class Dispatcher : public light::utils::NonCopyable,
@@ -35,11 +39,16 @@ public:
 
 public:
   Dispatcher(Looper &looper, int fd)
-      : looper_(&looper), attached_(false), events_(NO_EVENT), fd_(fd),
-        read_callback_(), write_callback_(), close_callback_(),
-        error_callback_(), poll_events_(false, false, false, false) {}
+      : looper_(&looper), attached_(false), edge_triggered_(false),
+        oneshot_(false), handling_(false), destroyed_(nullptr), poll_round_(0),
+        events_(NO_EVENT), polled_events_(NO_EVENT), update_list_(nullptr),
+        half_closed_(false), fd_(fd), read_callback_(), write_callback_(),
+        close_callback_(), error_callback_(), half_close_callback_(),
+        poll_events_(false, false, false, false, false) {}
 
   ~Dispatcher() {
+    if (destroyed_)
+      *destroyed_ = true;
     if (attached_)
       detach();
   }
@@ -65,6 +74,33 @@ public:
     events_ = NO_EVENT;
     reattach();
   }
+  // one poller call instead of two
+  void enable_all() {
+    events_ = READ_EVENT | WRITE_EVENT;
+    reattach();
+  }
+
+  /**
+   * @brief report readiness once per change instead of as long as it lasts,
+   * the callbacks have to drain the fd until EAGAIN. Takes effect on the
+   * next (re)attach, only for pollers that support it, see
+   * Looper::edge_triggered_supported().
+   */
+  void set_edge_triggered(bool edge_triggered) {
+    edge_triggered_ = edge_triggered;
+  }
+
+  bool edge_triggered() const { return edge_triggered_; }
+
+  /**
+   * @brief disarm the fd when an event is reported and arm it again once
+   * handle_events() returns, so at most one thread runs the callbacks.
+   * Interest changes made meanwhile are applied by the re-arm. Takes effect
+   * on the next (re)attach, see Looper::set_oneshot_dispatch().
+   */
+  void set_oneshot(bool oneshot) { oneshot_ = oneshot; }
+
+  bool oneshot() const { return oneshot_; }
 
   bool readable() { return events_ & READ_EVENT; }
   bool writable() { return events_ & WRITE_EVENT; }
@@ -81,6 +117,14 @@ public:
   void set_error_callback(const event_callback &cb) {
     error_callback_.set_callback(cb);
   }
+  /**
+   * @brief called once, right after the read callback of the event that
+   * reported the peer's shutdown, before the reads get to the eof. Pollers
+   * without EPOLLRDHUP or an equivalent never call it.
+   */
+  void set_half_close_callback(const event_callback &cb) {
+    half_close_callback_.set_callback(cb);
+  }
 
   void set_read_callback(event_callback &&cb) {
     read_callback_.set_callback(cb);
@@ -94,9 +138,26 @@ public:
   void set_error_callback(event_callback &&cb) {
     error_callback_.set_callback(cb);
   }
+  void set_half_close_callback(event_callback &&cb) {
+    half_close_callback_.set_callback(cb);
+  }
 
-  void set_poll_event_data(bool r, bool w, bool e, bool c);
-
+  void set_poll_event_data(bool r, bool w, bool e, bool c, bool h = false);
+
+  /**
+   * @brief set_poll_event_data() for the first report of a poll round, the
+   * later ones of the same round add their events
+   *
+   * @return true on the first report
+   */
+  bool merge_poll_event_data(uint64_t round, bool r, bool w, bool e, bool c,
+                             bool h = false);
+
+  /**
+   * @brief run the callbacks of every reported event in one pass: read,
+   * half close, write, error, then close. A callback that detaches or
+   * deletes the dispatcher skips the ones after it.
+   */
   void handle_events();
 
   int get_fd() const { return fd_; }
@@ -122,8 +183,15 @@ public:
   std::error_code detach();
   std::error_code attach();
   std::error_code reattach();
+  /**
+   * @brief hand the interest to the poller unless it already has it, for
+   * updates queued by Looper::defer_update()
+   */
+  std::error_code flush_update();
 
 protected:
+  friend class Looper;
+
   class DispatcherEventCallback {
   public:
     DispatcherEventCallback() : running_idx_(0), next_idx_(0) {}
@@ -163,19 +231,43 @@ protected:
 
   Looper *looper_;
   bool attached_;
+  bool edge_triggered_;
+  bool oneshot_;
+  // oneshot: reported and not re-armed yet, the poller must leave it alone
+  std::atomic_bool handling_;
+  // set while handle_events() runs the callbacks, one of them may delete
+  // the dispatcher
+  bool *destroyed_;
+  uint64_t poll_round_;
   int events_;
+  // events_ and the mode flags as the poller last saw them
+  int polled_events_;
+  // the list of the thread that queued an update by Looper::defer_update(),
+  // set and cleared under its lock
+  std::atomic<PendingUpdates *> update_list_;
+  // the half close callback has run
+  bool half_closed_;
   int fd_;
 
   DispatcherEventCallback read_callback_;
   DispatcherEventCallback write_callback_;
   DispatcherEventCallback close_callback_;
   DispatcherEventCallback error_callback_;
+  DispatcherEventCallback half_close_callback_;
 
   PollEventData poll_events_;
   int index_;
+
+  int poller_events() const {
+    return events_ | (edge_triggered_ ? EDGE_TRIGGERED_FLAG : 0) |
+           (oneshot_ ? ONESHOT_FLAG : 0);
+  }
+
   static const int NO_EVENT;
   static const int READ_EVENT;
   static const int WRITE_EVENT;
+  static const int EDGE_TRIGGERED_FLAG;
+  static const int ONESHOT_FLAG;
 };
 
 } /* network */
@@ -4,19 +4,24 @@
 namespace light {
 namespace network {
 
-EpollPoller::EpollPoller(Looper &looper) : Poller(looper), epollfd_(0) {
+EpollPoller::EpollPoller(Looper &looper)
+    : Poller(looper), events_(MAX_LOOPER_EVENTS), epollfd_(0) {
   if ((this->epollfd_ = epoll_create1(EPOLL_CLOEXEC)) == -1) {
     this->epollfd_ = 0;
     throw light::exception::EventException(LS_GENERIC_ERROR(errno));
   }
 }
 
-EpollPoller::~EpollPoller() {}
+EpollPoller::~EpollPoller() {
+  if (epollfd_ > 0)
+    ::close(epollfd_);
+}
 
 std::error_code
 EpollPoller::poll(int timeout,
-                  std::unordered_map<int, Dispatcher *> &active_dispatchers) {
-  int num_events = ::epoll_wait(epollfd_, events_, MAX_LOOPER_EVENTS, timeout);
+                  std::vector<Dispatcher *> &active_dispatchers) {
+  int num_events = ::epoll_wait(epollfd_, &events_[0],
+                                static_cast<int>(events_.size()), timeout);
   if (num_events < 0) {
     if (errno == EINTR) {
       return LS_OK_ERROR();
@@ -24,13 +29,20 @@ EpollPoller::poll(int timeout,
   } else if (num_events == 0) {
     return LS_OK_ERROR();
   } else {
+    std::lock_guard<std::mutex> lk(lock_);
     for (int i = 0; i < num_events; ++i) {
-      auto dispatcher = static_cast<Dispatcher *>(events_[i].data.ptr);
-      assert(dispatchers_.find(dispatcher->get_fd()) != dispatchers_.end());
+      uint64_t tag = events_[i].data.u64;
+      // removed, maybe freed, by a worker since the wait returned
+      Dispatcher *dispatcher =
+          dispatchers_.find(DispatcherTable::tag_fd(tag),
+                            DispatcherTable::tag_generation(tag));
+      if (!dispatcher)
+        continue;
       auto event = events_[i].events;
-      dispatcher->set_poll_event_data(event & (EPOLLIN | EPOLLPRI | EPOLLRDHUP),
+      dispatcher->set_poll_event_data(event & (EPOLLIN | EPOLLPRI),
                                       event & EPOLLOUT, event & EPOLLERR,
-                                      (event & EPOLLHUP) && !(event & EPOLLIN));
+                                      (event & EPOLLHUP) && !(event & EPOLLIN),
+                                      event & EPOLLRDHUP);
 
       /*
       DLOG(INFO) << "fd: " << dispatcher->get_fd() << " events: " << bool(event
@@ -39,55 +51,72 @@ EpollPoller::poll(int timeout,
               " " << bool(event & EPOLLERR) << " " << bool(event & EPOLLHUP) <<
       " " << bool(event & EPOLLRDHUP);
               */
-      active_dispatchers[dispatcher->get_fd()] = dispatcher;
+      active_dispatchers.push_back(dispatcher);
     }
+    // more may be waiting, take them in one call next time
+    if (static_cast<size_t>(num_events) == events_.size() &&
+        events_.size() < MAX_EVENTS)
+      events_.resize(events_.size() * 2);
   }
   return LS_OK_ERROR();
 }
 
 std::error_code EpollPoller::add_dispatcher(Dispatcher &dispatcher) {
-  assert(dispatchers_.find(dispatcher.get_fd()) == dispatchers_.end());
-
+  int fd = dispatcher.get_fd();
+  std::lock_guard<std::mutex> lk(lock_);
+  assert(!dispatchers_.find(fd));
+  uint32_t generation = dispatchers_.insert(dispatcher);
   struct epoll_event ev;
-  ev.events = 0;
-  if (dispatcher.readable())
-    ev.events |= EPOLLIN | EPOLLPRI;
-  if (dispatcher.writable())
-    ev.events |= EPOLLOUT;
-  ev.data.ptr = &dispatcher;
-  if (::epoll_ctl(epollfd_, EPOLL_CTL_ADD, dispatcher.get_fd(), &ev) == -1) {
-    return LS_GENERIC_ERROR(errno);
+  ev.events = epoll_events(dispatcher);
+  ev.data.u64 = DispatcherTable::tag(fd, generation);
+  if (::epoll_ctl(epollfd_, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    int err = errno;
+    dispatchers_.erase(fd);
+    return LS_GENERIC_ERROR(err);
   }
-  dispatchers_[dispatcher.get_fd()] = &dispatcher;
   return LS_OK_ERROR();
 }
 
 std::error_code EpollPoller::remove_dispatcher(Dispatcher &dispatcher) {
-  assert(dispatchers_.find(dispatcher.get_fd()) != dispatchers_.end());
+  assert(dispatchers_.find(dispatcher.get_fd()) == &dispatcher);
 
   struct epoll_event ev;
   if (::epoll_ctl(epollfd_, EPOLL_CTL_DEL, dispatcher.get_fd(), &ev) == -1) {
     return LS_GENERIC_ERROR(errno);
   }
+  std::lock_guard<std::mutex> lk(lock_);
   dispatchers_.erase(dispatcher.get_fd());
   return LS_OK_ERROR();
 }
 
 std::error_code EpollPoller::update_dispatcher(Dispatcher &dispatcher) {
-  assert(dispatchers_.find(dispatcher.get_fd()) != dispatchers_.end());
+  int fd = dispatcher.get_fd();
   struct epoll_event ev;
-  ev.events = 0;
-  if (dispatcher.readable())
-    ev.events |= EPOLLIN | EPOLLPRI;
-  if (dispatcher.writable())
-    ev.events |= EPOLLOUT;
-  ev.data.ptr = &dispatcher;
-  if (::epoll_ctl(epollfd_, EPOLL_CTL_MOD, dispatcher.get_fd(), &ev) == -1) {
+  ev.events = epoll_events(dispatcher);
+  {
+    std::lock_guard<std::mutex> lk(lock_);
+    assert(dispatchers_.find(fd) == &dispatcher);
+    ev.data.u64 = DispatcherTable::tag(fd, dispatchers_.generation(fd));
+  }
+  if (::epoll_ctl(epollfd_, EPOLL_CTL_MOD, fd, &ev) == -1) {
     return LS_GENERIC_ERROR(errno);
   }
   return LS_OK_ERROR();
 }
 
+uint32_t EpollPoller::epoll_events(Dispatcher &dispatcher) {
+  uint32_t events = 0;
+  if (dispatcher.readable())
+    events |= EPOLLIN | EPOLLPRI | EPOLLRDHUP;
+  if (dispatcher.writable())
+    events |= EPOLLOUT;
+  if (dispatcher.edge_triggered())
+    events |= EPOLLET;
+  if (dispatcher.oneshot())
+    events |= EPOLLONESHOT;
+  return events;
+}
+
 } /* network */
 } /* light */
 #endif
@@ -1,6 +1,7 @@
 #pragma once
 #include "config.h"
 #ifdef HAVE_EPOLL_H
+#include <mutex>
 #include <sys/epoll.h>
 #include "network/poller.h"
 #include "network/epoll_poller.h"
@@ -12,6 +13,11 @@ namespace network {
 
 #define MAX_LOOPER_EVENTS 20
 
+/**
+ * @brief level triggered by default. The event array starts at
+ * MAX_LOOPER_EVENTS and doubles whenever a wait fills it, up to
+ * MAX_EVENTS, so a busy looper drains the ready list in few calls.
+ */
 class EpollPoller : public Poller {
 public:
   EpollPoller(Looper &looper);
@@ -19,7 +25,7 @@ public:
   virtual ~EpollPoller();
 
   std::error_code
-  poll(int timeout, std::unordered_map<int, Dispatcher *> &active_dispatchers);
+  poll(int timeout, std::vector<Dispatcher *> &active_dispatchers);
 
   std::error_code add_dispatcher(Dispatcher &dispatcher);
 
@@ -27,9 +33,21 @@ public:
 
   std::error_code update_dispatcher(Dispatcher &dispatcher);
 
+  bool edge_triggered_supported() const { return true; }
+
+  bool oneshot_supported() const { return true; }
+
+  enum { MAX_EVENTS = 1 << 16 };
+
+  size_t event_capacity() const { return events_.size(); }
+
 private:
-  struct epoll_event events_[MAX_LOOPER_EVENTS];
+  static uint32_t epoll_events(Dispatcher &dispatcher);
+
+  std::vector<struct epoll_event> events_;
   int epollfd_;
+  // dispatchers_ changes on the workers while a oneshot looper polls
+  std::mutex lock_;
 };
 
 } /* network */
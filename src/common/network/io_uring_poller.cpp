@@ -0,0 +1,353 @@
+#include "config.h"
+#ifdef HAVE_IO_URING
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "network/io_uring_poller.h"
+namespace light {
+namespace network {
+
+namespace {
+// remove requests complete with this, their result is not interesting
+const uint64_t NO_USER_DATA = 0;
+
+inline uint64_t poll_user_data(int fd, uint32_t generation) {
+  return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+} /* anonymous */
+
+IoUringPoller::IoUringPoller(Looper &looper, unsigned entries)
+    : Poller(looper), ringfd_(-1), multishot_(false), sq_entries_(0),
+      cq_entries_(0),
+      sq_ring_(MAP_FAILED), sq_ring_size_(0), cq_ring_(MAP_FAILED),
+      cq_ring_size_(0), sqes_(static_cast<struct io_uring_sqe *>(MAP_FAILED)),
+      sq_head_(nullptr), sq_tail_(nullptr), sq_flags_(nullptr), sq_mask_(0),
+      sq_array_(nullptr), cq_head_(nullptr), cq_tail_(nullptr), cq_mask_(0),
+      cqes_(nullptr), interests_(), next_generation_(0), enter_count_(0) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof params);
+  ringfd_ = static_cast<int>(::syscall(SYS_io_uring_setup, entries, &params));
+  if (ringfd_ < 0) {
+    ringfd_ = -1;
+    throw light::exception::EventException(LS_GENERIC_ERROR(errno));
+  }
+
+  bool commit = false;
+  SCOPE_EXIT([this, &commit] {
+    if (!commit)
+      release();
+  });
+
+  // waiting with a timeout needs EXT_ARG, NODROP keeps completions when
+  // more polls finish than the completion queue holds
+  const unsigned required = IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+  if ((params.features & required) != required)
+    throw light::exception::EventException(LS_GENERIC_ERROR(ENOSYS));
+
+#ifdef IORING_POLL_ADD_MULTI
+  // multishot polls have no feature bit, they came together with
+  // resource tags
+  multishot_ = params.features & IORING_FEAT_RSRC_TAGS;
+#endif
+
+  sq_entries_ = params.sq_entries;
+  cq_entries_ = params.cq_entries;
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = (std::max)(sq_ring_size_, cq_ring_size_);
+  }
+
+  sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED)
+    throw light::exception::EventException(LS_GENERIC_ERROR(errno));
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ringfd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED)
+      throw light::exception::EventException(LS_GENERIC_ERROR(errno));
+  }
+  sqes_ = static_cast<struct io_uring_sqe *>(
+      ::mmap(nullptr, sq_entries_ * sizeof(struct io_uring_sqe),
+             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd_,
+             IORING_OFF_SQES));
+  if (sqes_ == MAP_FAILED)
+    throw light::exception::EventException(LS_GENERIC_ERROR(errno));
+
+  char *sq = static_cast<char *>(sq_ring_);
+  sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_flags_ = reinterpret_cast<unsigned *>(sq + params.sq_off.flags);
+  sq_mask_ = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  char *cq = static_cast<char *>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  // entries are used in ring order, the indirection array never changes
+  for (unsigned i = 0; i < sq_entries_; ++i) {
+    sq_array_[i] = i;
+  }
+  commit = true;
+}
+
+IoUringPoller::~IoUringPoller() { release(); }
+
+void IoUringPoller::release() {
+  if (sqes_ != MAP_FAILED)
+    ::munmap(sqes_, sq_entries_ * sizeof(struct io_uring_sqe));
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+    ::munmap(cq_ring_, cq_ring_size_);
+  if (sq_ring_ != MAP_FAILED)
+    ::munmap(sq_ring_, sq_ring_size_);
+  sqes_ = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+  sq_ring_ = cq_ring_ = MAP_FAILED;
+  if (ringfd_ >= 0)
+    ::close(ringfd_);
+  ringfd_ = -1;
+}
+
+std::error_code
+IoUringPoller::poll(int timeout,
+                    std::vector<Dispatcher *> &active_dispatchers) {
+  unsigned to_submit;
+  bool overflow;
+  {
+    std::lock_guard<std::mutex> lk(lock_);
+    to_submit = pending_sqes();
+    overflow = __atomic_load_n(sq_flags_, __ATOMIC_RELAXED) &
+               IORING_SQ_CQ_OVERFLOW;
+  }
+  bool ready = *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  // a non-blocking poll with nothing to submit is answered from the
+  // completion ring alone
+  if (to_submit || overflow || (timeout != 0 && !ready)) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof arg);
+    unsigned min_complete = 0;
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    if (overflow)
+      flags |= IORING_ENTER_GETEVENTS;
+    if (timeout != 0 && !ready) {
+      min_complete = 1;
+      flags |= IORING_ENTER_GETEVENTS;
+      if (timeout > 0) {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000LL;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+      }
+    }
+    std::error_code ec = enter(to_submit, min_complete, flags, &arg, sizeof arg);
+    if (ec && ec != LS_GENERIC_ERROR(ETIME) && ec != LS_GENERIC_ERROR(EINTR) &&
+        ec != LS_GENERIC_ERROR(EBUSY))
+      return ec;
+  }
+
+  std::lock_guard<std::mutex> lk(lock_);
+  reap(active_dispatchers);
+  return LS_OK_ERROR();
+}
+
+void IoUringPoller::reap(
+    std::vector<Dispatcher *> &active_dispatchers) {
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  // a multishot poll may complete more than once per reap
+  ++round_;
+  for (; head != tail; ++head) {
+    const struct io_uring_cqe &cqe = cqes_[head & cq_mask_];
+    if (cqe.user_data == NO_USER_DATA)
+      continue;
+    int fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+    uint32_t generation = static_cast<uint32_t>(cqe.user_data >> 32);
+    Dispatcher *dispatcher = dispatchers_.find(fd);
+    // removed, or replaced by an interest change
+    if (!dispatcher || interests_[fd].generation != generation)
+      continue;
+    Interest &interest = interests_[fd];
+    if (cqe.res < 0) {
+      report(*dispatcher, false, false, true, false, active_dispatchers);
+      // polling again would fail again at once, the error callback decides
+      interest.failed = true;
+      continue;
+    }
+    uint32_t event = static_cast<uint32_t>(cqe.res);
+    report(*dispatcher, event & (POLLIN | POLLPRI), event & POLLOUT,
+           event & POLLERR, (event & POLLHUP) && !(event & POLLIN),
+           active_dispatchers, event & POLLRDHUP);
+    // one-shot (or a multishot the kernel gave up), armed again with the
+    // next enter
+    bool armed = interest.oneshot;
+#ifdef IORING_CQE_F_MORE
+    armed = armed || (cqe.flags & IORING_CQE_F_MORE);
+#endif
+    if (!armed)
+      prep_poll_add(fd, interest);
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+std::error_code IoUringPoller::add_dispatcher(Dispatcher &dispatcher) {
+  std::lock_guard<std::mutex> lk(lock_);
+  assert(!dispatchers_.find(dispatcher.get_fd()));
+
+  int fd = dispatcher.get_fd();
+  Interest interest = make_interest(dispatcher);
+  std::error_code ec = prep_poll_add(fd, interest);
+  if (!ec)
+    ec = flush();
+  if (ec)
+    return ec;
+  if (static_cast<size_t>(fd) >= interests_.size())
+    interests_.resize(fd + 1);
+  interests_[fd] = interest;
+  dispatchers_.insert(dispatcher);
+  return LS_OK_ERROR();
+}
+
+std::error_code IoUringPoller::remove_dispatcher(Dispatcher &dispatcher) {
+  std::lock_guard<std::mutex> lk(lock_);
+  assert(dispatchers_.find(dispatcher.get_fd()) == &dispatcher);
+
+  int fd = dispatcher.get_fd();
+  std::error_code ec = prep_poll_remove(fd, interests_[fd]);
+  dispatchers_.erase(fd);
+  if (ec)
+    return ec;
+  // the poll holds a reference on the file, drop it before the fd is closed
+  return flush();
+}
+
+std::error_code IoUringPoller::update_dispatcher(Dispatcher &dispatcher) {
+  std::lock_guard<std::mutex> lk(lock_);
+  assert(dispatchers_.find(dispatcher.get_fd()) == &dispatcher);
+
+  int fd = dispatcher.get_fd();
+  Interest &interest = interests_[fd];
+  Interest wanted = make_interest(dispatcher);
+  if (wanted.mask == interest.mask && wanted.multishot == interest.multishot &&
+      wanted.oneshot == interest.oneshot)
+    return LS_OK_ERROR();
+  std::error_code ec = prep_poll_remove(fd, interest);
+  if (ec)
+    return ec;
+  interest = wanted;
+  ec = prep_poll_add(fd, interest);
+  if (ec)
+    return ec;
+  return flush();
+}
+
+std::error_code IoUringPoller::rearm_dispatcher(Dispatcher &dispatcher) {
+  std::lock_guard<std::mutex> lk(lock_);
+  assert(dispatchers_.find(dispatcher.get_fd()) == &dispatcher);
+
+  int fd = dispatcher.get_fd();
+  Interest &interest = interests_[fd];
+  Interest wanted = make_interest(dispatcher);
+  if (interest.failed && wanted.mask == interest.mask)
+    return LS_OK_ERROR();
+  // the previous poll has completed, only the new one is live
+  interest = wanted;
+  std::error_code ec = prep_poll_add(fd, interest);
+  if (ec)
+    return ec;
+  return flush();
+}
+
+IoUringPoller::Interest IoUringPoller::make_interest(Dispatcher &dispatcher) {
+  if (++next_generation_ == 0)
+    ++next_generation_;
+  Interest interest;
+  interest.generation = next_generation_;
+  interest.mask = 0;
+  if (dispatcher.readable())
+    interest.mask |= POLLIN | POLLPRI | POLLRDHUP;
+  if (dispatcher.writable())
+    interest.mask |= POLLOUT;
+  interest.oneshot = dispatcher.oneshot();
+  interest.failed = false;
+  interest.multishot =
+      multishot_ && dispatcher.edge_triggered() && !interest.oneshot;
+  return interest;
+}
+
+struct io_uring_sqe *IoUringPoller::get_sqe() {
+  while (pending_sqes() >= sq_entries_) {
+    if (flush())
+      return nullptr;
+  }
+  unsigned tail = *sq_tail_;
+  struct io_uring_sqe *sqe = &sqes_[tail & sq_mask_];
+  memset(sqe, 0, sizeof *sqe);
+  return sqe;
+}
+
+std::error_code IoUringPoller::prep_poll_add(int fd,
+                                             const Interest &interest) {
+  struct io_uring_sqe *sqe = get_sqe();
+  if (sqe == nullptr)
+    return LS_GENERIC_ERROR(EBUSY);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = interest.mask;
+#ifdef IORING_POLL_ADD_MULTI
+  if (interest.multishot)
+    sqe->len = IORING_POLL_ADD_MULTI;
+#endif
+  sqe->user_data = poll_user_data(fd, interest.generation);
+  __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+  return LS_OK_ERROR();
+}
+
+std::error_code IoUringPoller::prep_poll_remove(int fd,
+                                                const Interest &interest) {
+  struct io_uring_sqe *sqe = get_sqe();
+  if (sqe == nullptr)
+    return LS_GENERIC_ERROR(EBUSY);
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = poll_user_data(fd, interest.generation);
+  sqe->user_data = NO_USER_DATA;
+  __atomic_store_n(sq_tail_, *sq_tail_ + 1, __ATOMIC_RELEASE);
+  return LS_OK_ERROR();
+}
+
+unsigned IoUringPoller::pending_sqes() const {
+  return *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+}
+
+std::error_code IoUringPoller::flush() {
+  unsigned to_submit = pending_sqes();
+  if (to_submit == 0)
+    return LS_OK_ERROR();
+  return enter(to_submit, 0, 0, nullptr, 0);
+}
+
+std::error_code IoUringPoller::enter(unsigned to_submit,
+                                     unsigned min_complete, unsigned flags,
+                                     const void *arg, size_t arg_size) {
+  enter_count_.fetch_add(1, std::memory_order_relaxed);
+  // entries the kernel takes are copied before the call returns, whichever
+  // thread submits them
+  if (::syscall(SYS_io_uring_enter, ringfd_, to_submit, min_complete, flags,
+                arg, arg_size) < 0)
+    return LS_GENERIC_ERROR(errno);
+  return LS_OK_ERROR();
+}
+
+} /* network */
+} /* light */
+#endif
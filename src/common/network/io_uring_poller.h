@@ -0,0 +1,126 @@
+#pragma once
+#include "config.h"
+#ifdef HAVE_IO_URING
+#include <atomic>
+#include <linux/io_uring.h>
+#include <mutex>
+#include "network/poller.h"
+#include "utils/exception.h"
+#include "utils/helpers.h"
+
+namespace light {
+namespace network {
+
+/**
+ * @brief Poller on top of io_uring readiness polls, talking to the kernel
+ * through raw syscalls so no liburing is needed.
+ *
+ * Every dispatcher has one one-shot POLL_ADD in flight. A completion is
+ * re-armed by queueing a new POLL_ADD that goes to the kernel with the next
+ * io_uring_enter() of poll(), so a busy fd costs no syscall of its own,
+ * where epoll needs nothing either but every interest change costs an
+ * epoll_ctl(). The one-shot poll checks readiness when armed, which keeps
+ * the level-triggered behaviour of EpollPoller.
+ *
+ * Edge triggered dispatchers get a multishot poll instead when the kernel
+ * has them (5.13), it posts a completion per wakeup and stays armed.
+ *
+ * Interest changes replace the poll: the old one is removed by its
+ * user_data and a new one with a fresh generation is added, completions of
+ * an old generation are ignored.
+ *
+ * The constructor throws an EventException when the kernel lacks io_uring
+ * or the features used here, create_default_poller() then falls back to
+ * epoll.
+ */
+class IoUringPoller : public Poller {
+public:
+  IoUringPoller(Looper &looper, unsigned entries = 256);
+
+  virtual ~IoUringPoller();
+
+  std::error_code
+  poll(int timeout, std::vector<Dispatcher *> &active_dispatchers);
+
+  std::error_code add_dispatcher(Dispatcher &dispatcher);
+
+  std::error_code remove_dispatcher(Dispatcher &dispatcher);
+
+  std::error_code update_dispatcher(Dispatcher &dispatcher);
+
+  bool edge_triggered_supported() const { return multishot_; }
+
+  bool oneshot_supported() const { return true; }
+
+  std::error_code rearm_dispatcher(Dispatcher &dispatcher);
+
+  /**
+   * @brief io_uring_enter() calls made so far, for benchmarks
+   */
+  uint64_t enter_count() const {
+    return enter_count_.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Interest {
+    uint32_t generation;
+    uint32_t mask;
+    bool multishot;
+    // re-armed by rearm_dispatcher() only
+    bool oneshot;
+    // the poll completed with an error, nothing is armed until the
+    // interest changes
+    bool failed;
+  };
+
+  // with lock_ held, takes a new generation
+  Interest make_interest(Dispatcher &dispatcher);
+
+  void release();
+
+  // the ones below with lock_ held
+  struct io_uring_sqe *get_sqe();
+  std::error_code prep_poll_add(int fd, const Interest &interest);
+  std::error_code prep_poll_remove(int fd, const Interest &interest);
+  // hand every queued entry to the kernel
+  std::error_code flush();
+  void reap(std::vector<Dispatcher *> &active_dispatchers);
+
+  unsigned pending_sqes() const;
+
+  std::error_code enter(unsigned to_submit, unsigned min_complete,
+                        unsigned flags, const void *arg, size_t arg_size);
+
+  int ringfd_;
+  bool multishot_;
+  unsigned sq_entries_;
+  unsigned cq_entries_;
+
+  void *sq_ring_;
+  size_t sq_ring_size_;
+  void *cq_ring_;
+  size_t cq_ring_size_;
+  struct io_uring_sqe *sqes_;
+
+  unsigned *sq_head_;
+  unsigned *sq_tail_;
+  unsigned *sq_flags_;
+  unsigned sq_mask_;
+  unsigned *sq_array_;
+  unsigned *cq_head_;
+  unsigned *cq_tail_;
+  unsigned cq_mask_;
+  struct io_uring_cqe *cqes_;
+
+  // guards the submission queue, dispatchers_ and interests_, dispatchers
+  // may be added or changed from any thread while poll() waits
+  std::mutex lock_;
+  // indexed by fd like dispatchers_, valid where dispatchers_ has one
+  std::vector<Interest> interests_;
+  uint32_t next_generation_;
+  std::atomic<uint64_t> enter_count_;
+};
+
+} /* network */
+} /* light */
+#endif
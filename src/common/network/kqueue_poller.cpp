@@ -18,11 +18,14 @@ KqueuePoller::KqueuePoller(Looper &looper) : Poller(looper), kqueuefd_(0) {
   }
 }
 
-KqueuePoller::~KqueuePoller() {}
+KqueuePoller::~KqueuePoller() {
+  if (kqueuefd_ > 0)
+    ::close(kqueuefd_);
+}
 
 std::error_code
 KqueuePoller::poll(int timeout,
-                   std::unordered_map<int, Dispatcher *> &active_dispatchers) {
+                   std::vector<Dispatcher *> &active_dispatchers) {
 
   struct kevent ev[MAX_LOOPER_EVENTS];
 
@@ -38,21 +41,27 @@ KqueuePoller::poll(int timeout,
   } else if (num_events == 0) {
     return LS_OK_ERROR();
   } else {
+    // read and write filters of a fd come as separate events
+    ++round_;
     for (int i = 0; i < num_events; ++i) {
-      auto dispatcher = static_cast<Dispatcher *>(ev[i].udata);
+      // a fd removed earlier in this batch, maybe reused since
+      Dispatcher *dispatcher = dispatchers_.find(static_cast<int>(ev[i].ident));
+      if (dispatcher != ev[i].udata)
+        continue;
       int filter = ev[i].filter;
       int flags = ev[i].flags;
-      dispatcher->set_poll_event_data(filter == EVFILT_READ,
-                                      filter == EVFILT_WRITE, flags & EV_ERROR,
-                                      flags & EV_EOF);
-      active_dispatchers[dispatcher->get_fd()] = dispatcher;
+      // EV_EOF on the read filter is the peer's shutdown, data may be left
+      bool eof = flags & EV_EOF;
+      report(*dispatcher, filter == EVFILT_READ, filter == EVFILT_WRITE,
+             flags & EV_ERROR, eof && filter == EVFILT_WRITE,
+             active_dispatchers, eof && filter == EVFILT_READ);
     }
   }
   return LS_OK_ERROR();
 }
 
 std::error_code KqueuePoller::add_dispatcher(Dispatcher &dispatcher) {
-  assert(dispatchers_.find(dispatcher.get_fd()) == dispatchers_.end());
+  assert(!dispatchers_.find(dispatcher.get_fd()));
   int sock = dispatcher.get_fd();
   struct kevent ke;
   if (dispatcher.readable()) {
@@ -71,13 +80,13 @@ std::error_code KqueuePoller::add_dispatcher(Dispatcher &dispatcher) {
     }
   }
 
-  dispatchers_[dispatcher.get_fd()] = &dispatcher;
+  dispatchers_.insert(dispatcher);
   return LS_OK_ERROR();
 }
 
 std::error_code
 KqueuePoller::remove_dispatcher(Dispatcher &dispatcher) {
-  assert(dispatchers_.find(dispatcher.get_fd()) != dispatchers_.end());
+  assert(dispatchers_.find(dispatcher.get_fd()) == &dispatcher);
 
   int sock = dispatcher.get_fd();
   struct kevent ke;
@@ -96,7 +105,7 @@ KqueuePoller::remove_dispatcher(Dispatcher &dispatcher) {
 
 std::error_code
 KqueuePoller::update_dispatcher(Dispatcher &dispatcher) {
-  assert(dispatchers_.find(dispatcher.get_fd()) != dispatchers_.end());
+  assert(dispatchers_.find(dispatcher.get_fd()) == &dispatcher);
   int sock = dispatcher.get_fd();
   struct kevent ke;
   if (dispatcher.readable()) {
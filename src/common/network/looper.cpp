@@ -1,11 +1,156 @@
+#include <algorithm>
+#include <thread>
 #include "network/looper.h"
 
 namespace light {
 namespace network {
-Looper::Looper()
+
+// poller updates queued on one thread, see Looper::defer_update(). A
+// dispatcher detached on another thread takes itself out under the lock.
+struct PendingUpdates {
+  std::mutex lock;
+  std::vector<Dispatcher *> dispatchers;
+};
+
+namespace {
+// functors run from one strand before it yields to the other ready strands
+const size_t STRAND_BATCH = 64;
+// batches a lane with work may be passed over before it gets a turn
+const uint32_t AGING_ROUNDS = 8;
+// shortest spin worth doing once busy polling is on
+const Timestamp MIN_SPIN_US = 20;
+
+// looper whose loop() the current thread is in
+thread_local const Looper *current_looper = nullptr;
+
+// looper whose timers the current thread holds, see Looper::enter_timers()
+thread_local const Looper *timer_owner = nullptr;
+
+// held by Looper::cancel_update() and while a thread's list goes away
+std::mutex pending_updates_exit;
+
+struct LocalUpdates {
+  LocalUpdates() : updates(new PendingUpdates()) {}
+  ~LocalUpdates() {
+    std::lock_guard<std::mutex> lk(pending_updates_exit);
+    updates.reset();
+  }
+  std::unique_ptr<PendingUpdates> updates;
+};
+
+// poller updates queued on this thread, see Looper::defer_update()
+thread_local LocalUpdates pending_updates;
+thread_local int update_batch_depth = 0;
+
+// interest changes made while one is alive reach the poller when the
+// outermost one goes away
+struct UpdateBatch {
+  UpdateBatch() { ++update_batch_depth; }
+  ~UpdateBatch() {
+    if (--update_batch_depth)
+      return;
+    PendingUpdates &updates = *pending_updates.updates;
+    std::lock_guard<std::mutex> lk(updates.lock);
+    for (Dispatcher *dispatcher : updates.dispatchers) {
+      std::error_code ec = dispatcher->flush_update();
+      if (ec)
+        LOG(WARNING) << "poller update failed: " << ec.message();
+    }
+    updates.dispatchers.clear();
+  }
+};
+} /* anonymous */
+
+Strand::Strand(Looper &looper, int strand_id)
+    : looper_(&looper), strand_id_(strand_id), tasks_(), pending_(0),
+      lane_(PRIORITY_NORMAL), capacity_(0), overflow_policy_(OVERFLOW_REJECT),
+      to_drop_(0), rejected_count_(0), dropped_count_(0) {}
+
+Strand::~Strand() {
+  light::utils::LockFreeNode *node;
+  while ((node = tasks_.pop_front()) != nullptr) {
+    delete static_cast<TaskNode *>(node);
+  }
+}
+
+std::error_code Strand::make_room() {
+  size_t capacity = capacity_;
+  if (capacity == 0)
+    return LS_OK_ERROR();
+  while (pending_.load(std::memory_order_acquire) -
+             to_drop_.load(std::memory_order_acquire) >=
+         capacity) {
+    switch (overflow_policy_) {
+    case OVERFLOW_REJECT:
+      rejected_count_.fetch_add(1, std::memory_order_relaxed);
+      return LS_MISC_ERR_OBJ(queue_full);
+    case OVERFLOW_DROP_OLDEST:
+      // only the consumer may unlink, it skips the marked functors
+      to_drop_.fetch_add(1, std::memory_order_acq_rel);
+      dropped_count_.fetch_add(1, std::memory_order_relaxed);
+      return LS_OK_ERROR();
+    case OVERFLOW_BLOCK:
+    default:
+      if (looper_->in_loop_thread())
+        return LS_OK_ERROR();
+      std::this_thread::yield();
+      break;
+    }
+  }
+  return LS_OK_ERROR();
+}
+
+bool Strand::push(light::utils::Task &&task, bool keep) {
+  // link before counting, a counted functor is always reachable once the
+  // producers in front of it have finished linking
+  tasks_.push_back(new TaskNode(std::move(task), keep));
+  return pending_.fetch_add(1, std::memory_order_acq_rel) == 0;
+}
+
+bool Strand::run(size_t max) {
+  for (size_t i = 0; i < max; ++i) {
+    light::utils::LockFreeNode *node;
+    while ((node = tasks_.pop_front()) == nullptr) {
+      // another producer is still linking a node in front of ours
+      std::this_thread::yield();
+    }
+    std::unique_ptr<TaskNode> task(static_cast<TaskNode *>(node));
+    // a kept functor leaves the drop to the next one
+    size_t to_drop = task->keep ? 0 : to_drop_.load(std::memory_order_acquire);
+    bool drop = false;
+    while (to_drop && !(drop = to_drop_.compare_exchange_weak(
+                            to_drop, to_drop - 1, std::memory_order_acq_rel))) {
+    }
+    if (!drop)
+      task->task();
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      return false;
+  }
+  return true;
+}
+
+Looper::Looper(SchedulerType scheduler_type)
     : poller_(Poller::create_default_poller(*this)), stop_(false),
-      valid_dispatchers_(), queue_(), loop_callbacks_(), last_callback_idx_(0) {
+      exclusive_(false), oneshot_dispatch_(false), poll_owner_(false),
+      valid_dispatchers_(), events_(0), event_readers_(0),
+      queue_(), timer_ops_(), timers_busy_(false), timer_slack_(0),
+      timerfd_expire_(0), loop_hooks_(),
+      last_callback_idx_(0), next_iteration_requested_(false),
+      idle_iteration_(false),
+      scheduler_(Scheduler::create_scheduler(scheduler_type)),
+      notify_valid_(0), strands_(),
+      lanes_(), polling_(false), wakeup_pending_(false), wakeup_count_(0),
+      suppressed_wakeup_count_(0), update_count_(0),
+      timerfd_update_count_(0), capacity_(0),
+      overflow_policy_(OVERFLOW_REJECT), rejected_count_(0),
+      dropped_count_(0), unbounded_(), unbounded_popping_(false),
+      busy_poll_max_us_(0), spin_budget_us_(0),
+      avg_activity_gap_us_(0), last_activity_(0),
+      now_(light::utils::get_monotonic_timestamp()) {
   running_workers_.store(0);
+  for (auto &count : loop_hook_count_) {
+    count.store(0);
+  }
   int eventfd = 0, timerfd = 0;
   bool commit = false;
   SCOPE_EXIT([&eventfd, &timerfd, &commit] {
@@ -24,8 +169,8 @@ Looper::Looper()
   std::error_code ec;
 
 #ifdef HAVE_TIMERFD
-  // many cause leap second problem?
-  if ((timerfd = ::timerfd_create(CLOCK_REALTIME,
+  // timers run on the monotonic clock, wall clock steps don't move them
+  if ((timerfd = ::timerfd_create(CLOCK_MONOTONIC,
                                   TFD_NONBLOCK | TFD_CLOEXEC)) == -1) {
     throw light::exception::EventException(LS_GENERIC_ERROR(errno));
   }
@@ -36,19 +181,20 @@ Looper::Looper()
   // set timer callback
   timer_dispatcher_->enable_read();
   timer_dispatcher_->set_read_callback([timerfd, this] {
+    // the timerfd stays readable and is reported again, the holder merges
+    // the staged changes before it lets go
+    if (!enter_timers())
+      return;
     uint64_t times;
     ::read(timerfd, &times, sizeof times);
+    // an expired timerfd is disarmed
+    timerfd_expire_ = 0;
+    run_timer_ops();
     // check timers and call callbacks
-    queue_.update_time_now();
+    queue_.update_time(now());
     // update nearist timer
     update_timerfd_expire();
-  });
-
-  this->add_timer(ec, 1000, 1000, [this] {
-    std::unique_lock<std::mutex> plk(post_functor_lock_);
-    for (auto &kv : loop_callbacks_) {
-      kv.second();
-    }
+    leave_timers();
   });
 #endif
 
@@ -71,23 +217,46 @@ Looper::Looper()
   event_dispatcher_.reset(new Dispatcher(*this, pipes[0]));
   w_event_dispatcher_.reset(new Dispatcher(*this, pipes[1]));
   eventfd = pipes[0];
+#endif
 
+#if defined(HAVE_EVENTFD) || defined(HAVE_UNISTD_H)
   ec = event_dispatcher_->attach();
   if (ec)
     throw light::exception::EventException(ec);
 
   event_dispatcher_->enable_read();
 
-  event_dispatcher_->set_read_callback([eventfd, this] {
+  event_dispatcher_->set_read_callback([eventfd] {
     char buf[128];
-    ::recv(eventfd, buf, 128, 0);
+    ssize_t ret = ::read(eventfd, buf, sizeof buf);
+    UNUSED(ret);
   });
-
 #endif
   commit = true;
 }
 
+Looper::~Looper() {
+#ifdef HAVE_TIMERFD
+  int timerfd = timer_dispatcher_->get_fd();
+  timer_dispatcher_.reset();
+  ::close(timerfd);
+#endif
+#ifdef HAVE_EVENTFD
+  int eventfd = event_dispatcher_->get_fd();
+  event_dispatcher_.reset();
+  ::close(eventfd);
+#elif defined(HAVE_UNISTD_H)
+  int pipes[2] = {event_dispatcher_->get_fd(), w_event_dispatcher_->get_fd()};
+  event_dispatcher_.reset();
+  w_event_dispatcher_.reset();
+  ::close(pipes[0]);
+  ::close(pipes[1]);
+#endif
+}
+
 std::error_code Looper::add_dispatcher(Dispatcher &dispatcher) {
+  if (oneshot_dispatch_)
+    dispatcher.set_oneshot(true);
   return poller_->add_dispatcher(dispatcher);
 }
 
@@ -96,41 +265,167 @@ std::error_code Looper::remove_dispatcher(Dispatcher &dispatcher) {
 }
 
 std::error_code Looper::update_dispatcher(Dispatcher &dispatcher) {
+  update_count_.fetch_add(1, std::memory_order_relaxed);
   return poller_->update_dispatcher(dispatcher);
 }
 
+bool Looper::defer_update(Dispatcher &dispatcher) {
+  if (!update_batch_depth || !in_loop_thread())
+    return false;
+  PendingUpdates &updates = *pending_updates.updates;
+  std::lock_guard<std::mutex> lk(updates.lock);
+  updates.dispatchers.push_back(&dispatcher);
+  dispatcher.update_list_.store(&updates, std::memory_order_relaxed);
+  return true;
+}
+
+void Looper::cancel_update(Dispatcher &dispatcher) {
+  if (!dispatcher.update_list_.load())
+    return;
+  // the list may belong to another thread, it can't go away meanwhile
+  std::lock_guard<std::mutex> exit_lk(pending_updates_exit);
+  PendingUpdates *updates = dispatcher.update_list_.load();
+  if (!updates)
+    return;
+  std::lock_guard<std::mutex> lk(updates->lock);
+  // flushed while we waited
+  if (dispatcher.update_list_.load() != updates)
+    return;
+  auto it = std::find(updates->dispatchers.begin(),
+                      updates->dispatchers.end(), &dispatcher);
+  if (it != updates->dispatchers.end())
+    updates->dispatchers.erase(it);
+  dispatcher.update_list_.store(nullptr);
+}
+
+bool Looper::edge_triggered_supported() const {
+  return poller_->edge_triggered_supported();
+}
+
+std::error_code Looper::set_oneshot_dispatch(bool oneshot) {
+  if (oneshot && !poller_->oneshot_supported())
+    return LS_GENERIC_ERROR(ENOTSUP);
+  oneshot_dispatch_ = oneshot;
+  // ours are polled concurrently with the workers as well
+  for (Dispatcher *dispatcher :
+       {timer_dispatcher_.get(), event_dispatcher_.get()}) {
+    if (dispatcher && dispatcher->attached()) {
+      dispatcher->set_oneshot(oneshot);
+      dispatcher->reattach();
+    }
+  }
+  return LS_OK_ERROR();
+}
+
+std::error_code Looper::rearm_dispatcher(Dispatcher &dispatcher) {
+  return poller_->rearm_dispatcher(dispatcher);
+}
+
 Dispatcher &Looper::get_time_dispatcher() { return *timer_dispatcher_; }
 
 Dispatcher &Looper::get_event_dispatcher() { return *event_dispatcher_; }
 
 TimerId Looper::add_timer(std::error_code &ec, Timestamp timeout,
-                          Timestamp interval, const functor &time_callback) {
+                          Timestamp interval, const functor &time_callback,
+                          Timestamp slack) {
   ec = LS_OK_ERROR();
-  bool need_update;
-  auto ret = queue_.add_timer(timeout, interval, need_update, time_callback);
-  if (need_update) {
+  TimerId timer_id = queue_.reserve_id();
+  if (!timer_id) {
+    ec = LS_GENERIC_ERR_OBJ(not_enough_memory);
+    return 0;
+  }
+  // another thread may see a now() a whole poll old
+  Timestamp base =
+      in_loop_thread() ? now() : light::utils::get_monotonic_timestamp();
+  bool owner = timer_owner == this;
+  if (!owner && !(in_loop_thread() && enter_timers())) {
+    TimerOp op;
+    op.timer_id = timer_id;
+    op.when = base + timeout;
+    op.interval = interval;
+    op.slack = slack;
+    op.callback = time_callback;
+    timer_ops_.push_back(std::move(op));
+    notify_posted();
+    return timer_id;
+  }
+  // staged changes were made first
+  bool need_update = run_timer_ops();
+  bool added_first;
+  queue_.add_reserved(timer_id, base + timeout, interval, added_first,
+                      time_callback, slack);
+  if (need_update || added_first) {
     ec = update_timerfd_expire();
   }
-  return ret;
+  if (!owner)
+    leave_timers();
+  return timer_id;
 }
 
 void Looper::cancel_timer(std::error_code &ec, const TimerId timer_id) {
   ec = LS_OK_ERROR();
-  bool need_update;
-  queue_.del_timer(timer_id, need_update);
-  if (need_update) {
+  bool owner = timer_owner == this;
+  if (!owner && !(in_loop_thread() && enter_timers())) {
+    TimerOp op;
+    op.timer_id = timer_id;
+    op.cancel = true;
+    timer_ops_.push_back(std::move(op));
+    notify_posted();
+    return;
+  }
+  bool need_update = run_timer_ops();
+  bool cancelled_first;
+  queue_.del_timer(timer_id, cancelled_first);
+  if (need_update || cancelled_first) {
     ec = update_timerfd_expire();
   }
+  if (!owner)
+    leave_timers();
+}
+
+bool Looper::enter_timers() {
+  if (timer_owner == this)
+    return false;
+  if (timers_busy_.exchange(true, std::memory_order_acquire))
+    return false;
+  timer_owner = this;
+  return true;
+}
+
+void Looper::leave_timers() {
+  timer_owner = nullptr;
+  timers_busy_.store(false, std::memory_order_seq_cst);
+  // staged while we held them, the poller may have passed them over
+  if (timer_ops_.size())
+    notify_posted();
+}
+
+bool Looper::run_timer_ops() {
+  bool need_update = false;
+  TimerOp op;
+  while (timer_ops_.pop_front(op)) {
+    bool first;
+    if (op.cancel) {
+      queue_.del_timer(op.timer_id, first);
+    } else {
+      queue_.add_reserved(op.timer_id, op.when, op.interval, first,
+                          std::move(op.callback), op.slack);
+      op.callback = nullptr;
+    }
+    need_update = need_update || first;
+  }
+  return need_update;
 }
 
 std::error_code Looper::update_timerfd_expire() {
 #ifdef HAVE_TIMERFD
-  auto timer = queue_.get_nearist_timer();
+  Timestamp next = queue_.next_expiry();
+  if (next == timerfd_expire_)
+    return LS_OK_ERROR();
   struct itimerspec spec;
   spec.it_interval.tv_sec = 0;
   spec.it_interval.tv_nsec = 0;
-  if (timer) {
-    auto next = timer->get_next();
+  if (next) {
     spec.it_value.tv_sec = next / 1000000LL;
     spec.it_value.tv_nsec = next % 1000000LL * 1000;
   } else {
@@ -141,17 +436,156 @@ std::error_code Looper::update_timerfd_expire() {
                          nullptr)) == -1) {
     return LS_GENERIC_ERROR(errno);
   }
+  timerfd_expire_ = next;
+  timerfd_update_count_.fetch_add(1, std::memory_order_relaxed);
 #endif
   return LS_OK_ERROR();
 }
 
-void Looper::stop() { stop_ = true; }
+void Looper::stop() {
+  stop_ = true;
+  wakeup();
+}
+
+void Looper::notify_posted() {
+  if (wakeup_poller()) {
+    wakeup_count_.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    suppressed_wakeup_count_.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+bool Looper::wakeup_poller() {
+  // pairs with the fence in loop(): either we see polling_ set, or the
+  // poller sees our work before it blocks
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (polling_.load(std::memory_order_relaxed) &&
+      !wakeup_pending_.exchange(true, std::memory_order_acq_rel)) {
+    wakeup();
+    return true;
+  }
+  return false;
+}
+
+void Looper::request_next_iteration() {
+  next_iteration_requested_.store(true, std::memory_order_relaxed);
+  wakeup_poller();
+}
+
+void Looper::set_busy_poll(Timestamp max_spin_us) {
+  busy_poll_max_us_ = max_spin_us;
+  spin_budget_us_ = max_spin_us;
+  avg_activity_gap_us_ = 0;
+  last_activity_ = 0;
+}
+
+bool Looper::spin_poll(std::error_code &ec) {
+  if (spin_budget_us_ == 0)
+    return false;
+  Timestamp start = light::utils::get_monotonic_timestamp();
+  Timestamp now = start;
+  do {
+    ec = poller_->poll(0, valid_dispatchers_);
+    if (ec || !valid_dispatchers_.empty() || has_posted_work()) {
+      update_spin_budget(light::utils::get_monotonic_timestamp());
+      return true;
+    }
+    now = light::utils::get_monotonic_timestamp();
+  } while (now - start < spin_budget_us_);
+  return false;
+}
+
+void Looper::update_spin_budget(Timestamp now) {
+  if (last_activity_) {
+    Timestamp gap = now > last_activity_ ? now - last_activity_ : 0;
+    avg_activity_gap_us_ = (avg_activity_gap_us_ * 7 + gap) / 8;
+  }
+  last_activity_ = now;
+  // spinning pays off when the next event is likely to show up within the
+  // budget, past busy_poll_max_us_ we block right away
+  Timestamp wanted = (std::max)(avg_activity_gap_us_ * 2, MIN_SPIN_US);
+  spin_budget_us_ = wanted <= busy_poll_max_us_ ? wanted : 0;
+}
+
+bool Looper::has_posted_work() const {
+  if (scheduler_->size() || unbounded_.size())
+    return true;
+  for (auto &lane : lanes_) {
+    if (lane.count.load(std::memory_order_relaxed))
+      return true;
+  }
+  return false;
+}
+
+std::error_code Looper::make_room() {
+  size_t capacity = capacity_;
+  if (capacity == 0)
+    return LS_OK_ERROR();
+  while (scheduler_->size() >= capacity) {
+    switch (overflow_policy_) {
+    case OVERFLOW_REJECT:
+      rejected_count_.fetch_add(1, std::memory_order_relaxed);
+      return LS_MISC_ERR_OBJ(queue_full);
+    case OVERFLOW_DROP_OLDEST: {
+      // shed the least important work first
+      bool dropped = false;
+      for (int lane = PRIORITY_COUNT - 1; lane >= PRIORITY_HIGH && !dropped;
+           --lane) {
+        dropped = scheduler_->drop_oldest(static_cast<PostPriority>(lane));
+      }
+      if (dropped) {
+        dropped_count_.fetch_add(1, std::memory_order_relaxed);
+        return LS_OK_ERROR();
+      }
+      // the workers hold the queues right now
+      std::this_thread::yield();
+      break;
+    }
+    case OVERFLOW_BLOCK:
+    default:
+      // the loop thread would wait for itself
+      if (in_loop_thread())
+        return LS_OK_ERROR();
+      std::this_thread::yield();
+      break;
+    }
+  }
+  return LS_OK_ERROR();
+}
+
+bool Looper::in_loop_thread() const { return current_looper == this; }
+
+void Looper::wakeup() {
+#ifdef HAVE_EVENTFD
+  uint64_t one = 1;
+  ssize_t ret = ::write(event_dispatcher_->get_fd(), &one, sizeof one);
+  UNUSED(ret);
+#elif defined(HAVE_UNISTD_H)
+  char data = 1;
+  ssize_t ret = ::write(w_event_dispatcher_->get_fd(), &data, sizeof data);
+  UNUSED(ret);
+#endif
+}
 
 void Looper::loop() {
+  const Looper *outer = current_looper;
+  current_looper = this;
+  scheduler_->enter_worker();
+  SCOPE_EXIT([this, outer] {
+    scheduler_->leave_worker();
+    current_looper = outer;
+  });
   while (!stop_) {
     bool should_poll = false;
     int nowval = running_workers_.load();
-    if (nowval) {
+    if (oneshot_dispatch_) {
+      // reported dispatchers stay disarmed until handled, polling while
+      // the workers run cannot hand the same fd out twice
+      bool owner = false;
+      should_poll = poll_owner_.compare_exchange_strong(owner, true);
+      if (should_poll)
+        running_workers_.fetch_add(1);
+    } else if (nowval) {
       should_poll = false;
     } else {
       if (running_workers_.compare_exchange_weak(nowval, nowval + 1)) {
@@ -167,29 +601,75 @@ void Looper::loop() {
         notify_valid_ = 0;
       }
 
+      reclaim_events();
       valid_dispatchers_.clear();
 #ifdef HAVE_TIMERFD
-      const int64_t tick_milisec = -1;
+      int64_t tick_milisec = -1;
 #else
-      const int64_t tick_milisec = 1;
+      int64_t tick_milisec = 1;
 #endif
 
-      double load = 0;
-      Timestamp start = light::utils::get_timestamp();
-      auto ec = poller_->poll(tick_milisec, valid_dispatchers_);
-      Timestamp interval = light::utils::get_timestamp() - start;
+      if (idle_iteration_)
+        run_loop_hooks(LOOP_PHASE_IDLE);
+      run_loop_hooks(LOOP_PHASE_PREPARE);
+
+      // timers staged by other threads, skipped if a worker has the
+      // timers, it merges them itself before it lets go
+      if (timer_ops_.size() && enter_timers()) {
+        if (run_timer_ops()) {
+          auto tec = update_timerfd_expire();
+          if (tec)
+            LOG(WARNING) << "failed to update timer: " << tec.message();
+        }
+        leave_timers();
+      }
+
+      std::error_code ec;
+      if (!spin_poll(ec)) {
+        polling_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        // functors posted while nobody was polling got no wakeup
+        if (next_iteration_requested_.exchange(false,
+                                               std::memory_order_relaxed) ||
+            loop_hook_count_[LOOP_PHASE_IDLE].load(std::memory_order_relaxed) ||
+            has_posted_work() ||
+            (timer_ops_.size() &&
+             !timers_busy_.load(std::memory_order_relaxed)))
+          tick_milisec = 0;
+
+        double load = 0;
+        ec = poller_->poll(tick_milisec, valid_dispatchers_);
+        polling_.store(false, std::memory_order_relaxed);
+        wakeup_pending_.store(false, std::memory_order_release);
+        if (busy_poll_max_us_ && !valid_dispatchers_.empty())
+          update_spin_budget(light::utils::get_monotonic_timestamp());
+      }
+      update_now();
 
 #ifndef HAVE_TIMERFD
       tick_timer();
 #endif
-      for (auto &kv : valid_dispatchers_) {
-        Dispatcher *disp = kv.second;
-        post_functors_.push_back([disp]() { disp->handle_events(); });
+      if (exclusive_) {
+        // nobody else runs this looper, handle events in place
+        UpdateBatch batch;
+        for (Dispatcher *disp : valid_dispatchers_) {
+          disp->handle_events();
+        }
+      } else if (!valid_dispatchers_.empty()) {
+        // timers are control plane work, they are taken first
+        auto timer = std::find(valid_dispatchers_.begin(),
+                               valid_dispatchers_.end(),
+                               timer_dispatcher_.get());
+        if (timer != valid_dispatchers_.end())
+          std::iter_swap(valid_dispatchers_.begin(), timer);
+        events_.store(static_cast<uint64_t>(valid_dispatchers_.size()) << 32);
       }
 
       if (ec) {
         throw light::exception::EventException(ec);
       }
+      run_loop_hooks(LOOP_PHASE_CHECK);
+      idle_iteration_ = valid_dispatchers_.empty() && !has_posted_work();
       // waik up other threads
       {
         std::unique_lock<std::mutex> lk(cond_lock_);
@@ -197,12 +677,17 @@ void Looper::loop() {
       }
       cond_var_.notify_all();
       running_workers_.fetch_sub(1);
+      poll_owner_.store(false);
       functors_work();
     } else {
       // this is work thread
       std::unique_lock<std::mutex> lk(cond_lock_);
       // wait for signal
       cond_var_.wait(lk, [this] { return notify_valid_ == 1; });
+      // the next poll owner takes the lock to reset notify_valid_, a long
+      // callback must not hold it up
+      lk.unlock();
+      update_now();
       // wake up!
       functors_work();
     }
@@ -212,80 +697,182 @@ void Looper::loop() {
 
 void Looper::functors_work() {
   running_workers_.fetch_add(1);
-  
+
   while (true) {
-    std::function<void()> func;
-    do {
-      std::unique_lock<std::mutex> plk(post_functor_lock_);
-      // handle unsafe post functors
-      if (!post_functors_.empty()) {
-        int slice_count = (std::max)(post_functors_.size() /
-                                         std::thread::hardware_concurrency(),
-                                     static_cast<size_t>(1));
-        std::vector<functor> vec;
-        for (int i = 0; i < slice_count; ++i) {
-          if (post_functors_.empty())
-            break;
-          vec.emplace_back(std::move(post_functors_.front()));
-          post_functors_.pop_front();
-        }
-        func = std::bind([](const std::vector<functor> &func_vec) {
-          for (auto &v : func_vec) {
-            v();
-          }
-        }, std::move(vec));
-        break;
+    UpdateBatch batch;
+    // poll results go before the posted functors
+    if (run_events() || run_unbounded())
+      continue;
+    // handle unsafe post functors
+    // a lower lane passed over too often goes first once
+    bool aged = false;
+    for (int lane = PRIORITY_COUNT - 1; lane > PRIORITY_HIGH && !aged;
+         --lane) {
+      auto &skipped = lanes_[lane].skipped;
+      if (skipped.load(std::memory_order_relaxed) >= AGING_ROUNDS) {
+        skipped.store(0, std::memory_order_relaxed);
+        aged = run_lane(static_cast<PostPriority>(lane));
       }
+    }
+    if (aged)
+      continue;
 
-      // handle safe post functors
-      if (!unique_post_functors_.empty()) {
-        for (auto it = unique_post_functors_.begin();
-             it != unique_post_functors_.end(); ++it) {
-          auto unique_id = it->first;
-          if (running_post_queue_ids_.find(unique_id) !=
-              running_post_queue_ids_.end())
-            continue;
-          running_post_queue_ids_.insert(unique_id);
-          func = std::bind([this, unique_id](const std::vector<functor> &vec) {
-            for (auto &v : vec) {
-              v();
-            }
-            std::unique_lock<std::mutex> pfk(post_functor_lock_);
-            running_post_queue_ids_.erase(unique_id);
-          }, std::move(it->second));
-          unique_post_functors_.erase(it);
-          break;
-        }
+    int ran = PRIORITY_COUNT;
+    for (int lane = PRIORITY_HIGH; lane < PRIORITY_COUNT; ++lane) {
+      if (run_lane(static_cast<PostPriority>(lane))) {
+        ran = lane;
+        break;
       }
-    } while (false);
-
-    if (func) {
-      func();
-    } else {
+    }
+    if (ran == PRIORITY_COUNT)
       break;
+    for (int lane = ran + 1; lane < PRIORITY_COUNT; ++lane) {
+      if (lane_depth(static_cast<PostPriority>(lane)))
+        lanes_[lane].skipped.fetch_add(1, std::memory_order_relaxed);
     }
   }
   running_workers_.fetch_sub(1);
 }
 
-int Looper::register_loop_callback(const loop_callback_t &func, int idx) {
-  std::unique_lock<std::mutex> plk(post_functor_lock_);
+bool Looper::run_events() {
+  bool ran = false;
+  while (true) {
+    Dispatcher *disp = nullptr;
+    event_readers_.fetch_add(1);
+    uint64_t state = events_.load();
+    while ((state & 0xffffffffULL) < (state >> 32)) {
+      if (events_.compare_exchange_weak(state, state + 1)) {
+        disp = valid_dispatchers_[state & 0xffffffffULL];
+        break;
+      }
+    }
+    event_readers_.fetch_sub(1);
+    if (!disp)
+      return ran;
+    disp->handle_events();
+    ran = true;
+  }
+}
+
+void Looper::reclaim_events() {
+  if (events_.load()) {
+    UpdateBatch batch;
+    run_events();
+  }
+  // nobody takes an index from now on, wait for the ones who just did
+  events_.store(0);
+  while (event_readers_.load()) {
+    std::this_thread::yield();
+  }
+}
+
+bool Looper::run_unbounded() {
+  if (unbounded_.empty() ||
+      unbounded_popping_.exchange(true, std::memory_order_acquire))
+    return false;
+  light::utils::Task task;
+  bool taken = unbounded_.pop_front(task);
+  unbounded_popping_.store(false, std::memory_order_release);
+  if (taken)
+    task();
+  return taken;
+}
+
+bool Looper::run_lane(PostPriority lane) {
+  // unsafe post functors first, then strands
+  return scheduler_->run_batch(lane) || run_ready_strand(lane);
+}
+
+bool Looper::run_ready_strand(PostPriority lane) {
+  Lane &ready = lanes_[lane];
+  if (ready.popping.exchange(true, std::memory_order_acquire))
+    return false;
+  auto strand = static_cast<Strand *>(ready.strands.pop_front());
+  ready.popping.store(false, std::memory_order_release);
+  if (strand == nullptr)
+    return false;
+  ready.count.fetch_sub(1, std::memory_order_relaxed);
+
+  // the strand is off the ready list, no other worker can pick it until it
+  // is pushed back
+  if (strand->run(STRAND_BATCH)) {
+    push_ready_strand(*strand);
+  }
+  return true;
+}
+
+void Looper::push_ready_strand(Strand &strand) {
+  Lane &ready = lanes_[strand.lane_];
+  ready.count.fetch_add(1, std::memory_order_relaxed);
+  ready.strands.push_back(&strand);
+}
+
+Strand &Looper::get_strand(int strand_id) {
+  std::lock_guard<std::mutex> lock(strand_lock_);
+  auto &strand = strands_[strand_id];
+  if (!strand)
+    strand.reset(new Strand(*this, strand_id));
+  return *strand;
+}
+
+int Looper::add_loop_hook(LoopPhase phase, const loop_callback_t &hook,
+                          int idx) {
+  assert(phase >= 0 && phase < LOOP_PHASE_COUNT);
+  std::unique_lock<std::mutex> plk(loop_callback_lock_);
   if (idx == -1)
     idx = ++last_callback_idx_;
-  assert(loop_callbacks_.find(idx) == loop_callbacks_.end());
-  loop_callbacks_[idx] = func;
+  else
+    last_callback_idx_ = (std::max)(last_callback_idx_, idx);
+  assert(loop_hooks_.find(idx) == loop_hooks_.end());
+  LoopHook &entry = loop_hooks_[idx];
+  entry.phase = phase;
+  entry.func = hook;
+  loop_hook_count_[phase].fetch_add(1, std::memory_order_relaxed);
+  plk.unlock();
+  // a blocked poller would only see the hook after its next event
+  request_next_iteration();
   return idx;
 }
 
-void Looper::unregister_loop_callback(int idx) {
-  std::unique_lock<std::mutex> plk(post_functor_lock_);
-  assert(loop_callbacks_.find(idx) != loop_callbacks_.end());
-  loop_callbacks_.erase(idx);
+void Looper::remove_loop_hook(int idx) {
+  std::unique_lock<std::mutex> plk(loop_callback_lock_);
+  auto it = loop_hooks_.find(idx);
+  assert(it != loop_hooks_.end());
+  loop_hook_count_[it->second.phase].fetch_sub(1, std::memory_order_relaxed);
+  loop_hooks_.erase(it);
+}
+
+int Looper::register_loop_callback(const loop_callback_t &func, int idx) {
+  return add_loop_hook(LOOP_PHASE_CHECK, func, idx);
+}
+
+void Looper::unregister_loop_callback(int idx) { remove_loop_hook(idx); }
+
+void Looper::run_loop_hooks(LoopPhase phase) {
+  if (!loop_hook_count_[phase].load(std::memory_order_relaxed))
+    return;
+  // held while running, remove_loop_hook() returns once the hook is done
+  std::unique_lock<std::mutex> plk(loop_callback_lock_);
+  for (auto &kv : loop_hooks_) {
+    if (kv.second.phase == phase)
+      kv.second.func();
+  }
+}
+
+Timestamp Looper::update_now() {
+  Timestamp now = light::utils::get_monotonic_timestamp();
+  now_.store(now, std::memory_order_relaxed);
+  return now;
 }
 
 void Looper::tick_timer() {
-  queue_.update_time_now();
+  // the next iteration ticks again
+  if (!enter_timers())
+    return;
+  run_timer_ops();
+  queue_.update_time(now());
   update_timerfd_expire();
+  leave_timers();
 }
 
 } /* network */
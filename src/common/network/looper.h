@@ -4,8 +4,8 @@
 #include <atomic>
 #include <condition_variable>
 #include <mutex>
-#include <list>
 #include <stdio.h>
+#include <unordered_map>
 #ifdef HAVE_EVENTFD
 #include <sys/eventfd.h>
 #endif
@@ -15,7 +15,10 @@
 #endif
 
 #include "network/poller.h"
+#include "network/scheduler.h"
 #include "network/timer.h"
+#include "utils/lockfree_queue.h"
+#include "utils/task.h"
 namespace light {
 namespace network {
 
@@ -27,33 +30,132 @@ struct RawMessage {
 };
 
 class Looper;
+class Strand;
 
 template <typename FUNC> class SafeCallWrapper {
 public:
-  SafeCallWrapper(Looper &looper, FUNC func, int strand_id)
-      : looper_(&looper), func_(func), strand_id_(strand_id) {}
+  SafeCallWrapper(Looper &looper, FUNC func, Strand *strand)
+      : looper_(&looper), func_(func), strand_(strand) {}
 
   template <typename... ARGS> void operator()(ARGS &&... args);
 
 private:
   Looper *looper_;
   FUNC func_;
-  int strand_id_;
+  Strand *strand_;
 };
 
-class Strand {
+/**
+ * @brief what a post does when the queue is at its capacity
+ *
+ * OVERFLOW_BLOCK waits until there is room, except on a thread running the
+ * looper itself where waiting could never end, the post is then accepted.
+ * OVERFLOW_REJECT fails the post with queue_full. OVERFLOW_DROP_OLDEST
+ * destroys the oldest queued functor without running it, captured
+ * resources are released by their destructors only. Poll results are not
+ * queued functors, they are never dropped.
+ */
+enum OverflowPolicy { OVERFLOW_BLOCK, OVERFLOW_REJECT, OVERFLOW_DROP_OLDEST };
+
+/**
+ * @brief functors posted to the same strand run one at a time and in post
+ * order. A strand owns a lock free queue of its functors and is linked onto
+ * the ready list of its looper only when it goes from idle to runnable, so
+ * picking the next strand to run is O(1) whatever the number of strands.
+ */
+class Strand : public light::utils::LockFreeNode,
+               public light::utils::NonCopyable {
 public:
-  Strand(Looper &looper, int strand_id)
-      : looper_(&looper), strand_id_(strand_id) {}
+  Strand(Looper &looper, int strand_id);
+
+  ~Strand();
 
   template <typename FUNC, typename... ARGS>
-  void post(FUNC func, ARGS &&... args);
+  std::error_code post(FUNC &&func, ARGS &&... args);
 
   template <typename FUNC> SafeCallWrapper<FUNC> wrap(FUNC func);
 
+  int get_id() const { return strand_id_; }
+
+  /**
+   * @brief number of functors posted and not finished yet
+   */
+  size_t size() const { return pending_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief limit size(), the functor being run counts, 0 means unbounded
+   */
+  void set_capacity(size_t capacity,
+                    OverflowPolicy policy = OVERFLOW_REJECT) {
+    capacity_ = capacity;
+    overflow_policy_ = policy;
+  }
+
+  size_t capacity() const { return capacity_; }
+
+  uint64_t rejected_count() const {
+    return rejected_count_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t dropped_count() const {
+    return dropped_count_.load(std::memory_order_relaxed);
+  }
+
+private:
+  friend class Looper;
+
+  struct TaskNode : public light::utils::LockFreeNode {
+    TaskNode(light::utils::Task &&t, bool k) : task(std::move(t)), keep(k) {}
+    light::utils::Task task;
+    // posted by Looper::strand_post_unbounded(), never dropped
+    bool keep;
+  };
+
+  /**
+   * @brief apply the overflow policy before a push
+   */
+  std::error_code make_room();
+
+  /**
+   * @return true if the strand was idle and has to be scheduled
+   */
+  bool push(light::utils::Task &&task, bool keep = false);
+
+  /**
+   * @brief run at most max functors, only one thread at a time
+   *
+   * @return true if functors are left and the strand has to be rescheduled
+   */
+  bool run(size_t max);
+
 private:
   Looper *looper_;
   int strand_id_;
+  light::utils::IntrusiveLockFreeQueue tasks_;
+  // posted but not finished functors, the strand is idle when it is 0
+  std::atomic<size_t> pending_;
+  // lane the strand is queued in while runnable
+  PostPriority lane_;
+
+  size_t capacity_;
+  OverflowPolicy overflow_policy_;
+  // oldest queued functors to destroy instead of running them
+  std::atomic<size_t> to_drop_;
+  std::atomic<uint64_t> rejected_count_;
+  std::atomic<uint64_t> dropped_count_;
+};
+
+/**
+ * @brief hook points of one Looper iteration, run by the polling thread.
+ * Idle hooks run first when the previous iteration had neither events nor
+ * posted functors, prepare hooks run right before poll(), check hooks right
+ * after the poll results have been dispatched.
+ */
+enum LoopPhase {
+  LOOP_PHASE_IDLE,
+  LOOP_PHASE_PREPARE,
+  LOOP_PHASE_CHECK,
+  LOOP_PHASE_COUNT
 };
 
 class Looper {
@@ -63,7 +165,13 @@ public:
   typedef std::lock_guard<std::mutex> lock_guard_t;
 
 public:
-  Looper();
+  /**
+   * @param scheduler_type unstranded posts run in post order by default,
+   * WORK_STEALING_SCHEDULER is opt-in, see WorkStealingScheduler
+   */
+  explicit Looper(SchedulerType scheduler_type = SLICE_SCHEDULER);
+
+  ~Looper();
 
   void loop();
 
@@ -73,19 +181,138 @@ public:
 
   std::error_code update_dispatcher(Dispatcher &dispatcher);
 
+  /**
+   * @brief called by Dispatcher::reattach(). On a thread running callbacks
+   * or posted functors of this looper the poller update is queued and made
+   * once that batch is done, with the interest the dispatcher ends up with,
+   * so toggling an event within a batch costs at most one epoll_ctl().
+   *
+   * @return false if the caller has to update the poller itself
+   */
+  bool defer_update(Dispatcher &dispatcher);
+
+  /**
+   * @brief forget a queued update, the dispatcher is being detached. It is
+   * taken out of the batch of whichever thread queued it, a flush running
+   * there right now is waited for.
+   */
+  void cancel_update(Dispatcher &dispatcher);
+
+  /**
+   * @brief whether Dispatcher::set_edge_triggered() is honoured by the
+   * poller of this looper
+   */
+  bool edge_triggered_supported() const;
+
+  /**
+   * @brief dispatchers attached from now on are oneshot, see
+   * Dispatcher::set_oneshot(). Their callbacks never run on two threads at
+   * once, so a thread may poll again while the others still run callbacks
+   * instead of waiting for all of them, without locking inside the
+   * connections. Call before loop().
+   *
+   * @return ENOTSUP if the poller has no oneshot mode
+   */
+  std::error_code set_oneshot_dispatch(bool oneshot);
+
+  bool oneshot_dispatch() const { return oneshot_dispatch_; }
+
+  std::error_code rearm_dispatcher(Dispatcher &dispatcher);
+
   Dispatcher &get_time_dispatcher();
 
   Dispatcher &get_event_dispatcher();
 
+  /**
+   * @param timeout microseconds, counted from now() on the loop threads
+   * and from the current time elsewhere
+   *
+   * @param slack how late the timer may fire, see TimerQueue::add_timer().
+   * The overload without it uses timer_slack().
+   *
+   * Any thread may add and cancel timers. A loop thread applies the change
+   * at once unless another one is busy with the timers; other threads
+   * stage it and the loop merges the staged changes before it polls. The
+   * id is valid either way, cancelling it after the timer is gone does
+   * nothing.
+   */
   TimerId add_timer(std::error_code &ec, Timestamp timeout,
-                    Timestamp interval, const functor &time_callback);
+                    Timestamp interval, const functor &time_callback,
+                    Timestamp slack);
+
+  TimerId add_timer(std::error_code &ec, Timestamp timeout,
+                    Timestamp interval, const functor &time_callback) {
+    return add_timer(ec, timeout, interval, time_callback, timer_slack_);
+  }
+
+  /**
+   * @brief default slack of add_timer() in microseconds, 0 fires every
+   * timer on its own millisecond tick. Call before the timers are added.
+   */
+  void set_timer_slack(Timestamp slack) { timer_slack_ = slack; }
+
+  Timestamp timer_slack() const { return timer_slack_; }
 
   void cancel_timer(std::error_code &ec, const TimerId timer_id);
 
-  std::error_code update_timerfd_expire();
+  /**
+   * @brief CLOCK_MONOTONIC microseconds read once per iteration, when the
+   * poll returns or a worker wakes up. Every callback of the iteration sees
+   * the same value without a clock read, a long callback makes it lag
+   * behind. Only the monotonic clock is cached, log lines read the wall
+   * clock when they are written.
+   */
+  Timestamp now() const { return now_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief read the clock into now()
+   */
+  Timestamp update_now();
+
+  /**
+   * @brief CLOCK_MONOTONIC_COARSE, fresher than now() outside the loop and
+   * cheaper than a clock read, with a resolution of a few milliseconds
+   */
+  static Timestamp coarse_now() {
+    return light::utils::get_coarse_monotonic_timestamp();
+  }
 
   void stop();
 
+  /**
+   * @brief mark this looper as driven by exactly one thread (e.g. a member of
+   * a LooperGroup), poll results are then handled in place instead of being
+   * shared out to the workers
+   */
+  void set_exclusive(bool exclusive) { exclusive_ = exclusive; }
+
+  bool exclusive() const { return exclusive_; }
+
+  /**
+   * @brief add a hook run on every iteration in the given phase. Hooks of a
+   * phase run one at a time in ascending id order and never concurrently
+   * with any other hook. A hook must not add or remove hooks. While an idle
+   * hook is registered the looper does not block in poll().
+   *
+   * @param idx id of the hook, -1 to pick the next free one
+   *
+   * @return the id, pass it to remove_loop_hook()
+   */
+  int add_loop_hook(LoopPhase phase, const loop_callback_t &hook,
+                    int idx = -1);
+
+  void remove_loop_hook(int idx);
+
+  /**
+   * @brief make the next poll() return at once so that every phase runs
+   * again soon, e.g. from a check hook that could not flush everything.
+   * Thread safe.
+   */
+  void request_next_iteration();
+
+  /**
+   * @brief same as add_loop_hook(LOOP_PHASE_CHECK, func, idx)
+   */
   int register_loop_callback(const loop_callback_t &func, int idx = -1);
   void unregister_loop_callback(int idx);
 
@@ -100,8 +327,20 @@ public:
    * @param args 
    */
   template <typename FUNC, typename... ARGS>
-  void post(FUNC func, ARGS &&... args) {
-    strand_post(0, func, std::forward<ARGS>(args)...);
+  std::error_code post(FUNC &&func, ARGS &&... args) {
+    return strand_post(0, PRIORITY_NORMAL, std::forward<FUNC>(func),
+                       std::forward<ARGS>(args)...);
+  }
+
+  /**
+   * @brief post into a priority lane. Lanes are drained from PRIORITY_HIGH
+   * down, a lower lane that keeps being passed over gets a turn every
+   * AGING_ROUNDS batches so it cannot starve.
+   */
+  template <typename FUNC, typename... ARGS>
+  std::error_code post(PostPriority priority, FUNC &&func, ARGS &&... args) {
+    return strand_post(0, priority, std::forward<FUNC>(func),
+                       std::forward<ARGS>(args)...);
   }
 
   /**
@@ -116,20 +355,115 @@ public:
    * @param args
    */
   template <typename FUNC, typename... ARGS>
-  void strand_post(int strand_id, FUNC func, ARGS &&... args) {
-    lock_guard_t lock(post_functor_lock_);
-    char data = 1;
-#ifdef HAVE_EVENTFD
-    int ret = ::send(event_dispatcher_->get_fd(), &data, sizeof data, 0);
-#elif defined(HAVE_UNISTD_H)
-    int ret = ::send(w_event_dispatcher_->get_fd(), &data, sizeof data, 0);
-#endif
+  std::error_code strand_post(int strand_id, FUNC &&func, ARGS &&... args) {
+    return strand_post(strand_id, PRIORITY_NORMAL, std::forward<FUNC>(func),
+                       std::forward<ARGS>(args)...);
+  }
+
+  template <typename FUNC, typename... ARGS>
+  std::error_code strand_post(int strand_id, PostPriority priority,
+                              FUNC &&func, ARGS &&... args) {
     if (strand_id) {
-      unique_post_functors_[strand_id].push_back(
-          std::bind(func, std::forward<ARGS>(args)...));
-    } else {
-      post_functors_.push_back(std::bind(func, std::forward<ARGS>(args)...));
+      return strand_post(get_strand(strand_id), priority,
+                         std::forward<FUNC>(func),
+                         std::forward<ARGS>(args)...);
     }
+    auto ec = make_room();
+    if (ec)
+      return ec;
+    scheduler_->post(light::utils::make_task(std::forward<FUNC>(func),
+                                             std::forward<ARGS>(args)...),
+                     priority);
+    notify_posted();
+    return LS_OK_ERROR();
+  }
+
+  template <typename FUNC, typename... ARGS>
+  std::error_code strand_post(Strand &strand, FUNC &&func, ARGS &&... args) {
+    return strand_post(strand, PRIORITY_NORMAL, std::forward<FUNC>(func),
+                       std::forward<ARGS>(args)...);
+  }
+
+  /**
+   * @brief functors of a strand keep their post order, the priority only
+   * picks the lane the strand is queued in when this post makes it runnable
+   */
+  template <typename FUNC, typename... ARGS>
+  std::error_code strand_post(Strand &strand, PostPriority priority,
+                              FUNC &&func, ARGS &&... args) {
+    auto ec = strand.make_room();
+    if (ec)
+      return ec;
+    // a strand that was already runnable is owned by whoever queued or runs
+    // it, nobody needs to be woken up
+    if (strand.push(light::utils::make_task(std::forward<FUNC>(func),
+                                            std::forward<ARGS>(args)...))) {
+      strand.lane_ = priority;
+      push_ready_strand(strand);
+      notify_posted();
+    }
+    return LS_OK_ERROR();
+  }
+
+  /**
+   * @brief post() past the capacity limit, and OVERFLOW_DROP_OLDEST never
+   * drops it either. For the little work that must not be shed, such as
+   * tearing down a connection; it runs ahead of the lanes.
+   */
+  template <typename FUNC, typename... ARGS>
+  void post_unbounded(FUNC &&func, ARGS &&... args) {
+    unbounded_.push_back(light::utils::make_task(std::forward<FUNC>(func),
+                                                 std::forward<ARGS>(args)...));
+    notify_posted();
+  }
+
+  /**
+   * @brief strand_post() past the capacity limit of the strand and never
+   * dropped, see post_unbounded(). The strand is queued in PRIORITY_HIGH
+   * when this post makes it runnable.
+   */
+  template <typename FUNC, typename... ARGS>
+  void strand_post_unbounded(Strand &strand, FUNC &&func, ARGS &&... args) {
+    if (strand.push(light::utils::make_task(std::forward<FUNC>(func),
+                                            std::forward<ARGS>(args)...),
+                    true)) {
+      strand.lane_ = PRIORITY_HIGH;
+      push_ready_strand(strand);
+      notify_posted();
+    }
+  }
+
+  /**
+   * @brief limit the unstranded functors queued in all lanes, strands have
+   * their own limit, see Strand::set_capacity(). 0 means unbounded.
+   */
+  void set_capacity(size_t capacity,
+                    OverflowPolicy policy = OVERFLOW_REJECT) {
+    capacity_ = capacity;
+    overflow_policy_ = policy;
+  }
+
+  size_t capacity() const { return capacity_; }
+
+  uint64_t rejected_count() const {
+    return rejected_count_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t dropped_count() const {
+    return dropped_count_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief true on a thread currently running loop() of this looper
+   */
+  bool in_loop_thread() const;
+
+  /**
+   * @brief queued unstranded functors plus runnable strands of a lane
+   */
+  size_t lane_depth(PostPriority lane) const {
+    return scheduler_->size(lane) +
+           lanes_[lane].count.load(std::memory_order_relaxed);
   }
 
   /**
@@ -146,16 +480,140 @@ public:
 
   template <typename FUNC>
   SafeCallWrapper<FUNC> strand_wrap(FUNC func, int strand_id) {
-    return SafeCallWrapper<FUNC>(*this, func, strand_id);
+    return SafeCallWrapper<FUNC>(*this, func,
+                                 strand_id ? &get_strand(strand_id) : nullptr);
+  }
+
+  template <typename FUNC>
+  SafeCallWrapper<FUNC> strand_wrap(FUNC func, Strand &strand) {
+    return SafeCallWrapper<FUNC>(*this, func, &strand);
+  }
+
+  /**
+   * @brief find or create the strand with this id, the reference stays valid
+   * as long as the looper, callers on a hot path should keep it
+   */
+  Strand &get_strand(int strand_id);
+
+  /**
+   * @brief number of eventfd writes done for posted functors
+   */
+  uint64_t wakeup_count() const {
+    return wakeup_count_.load(std::memory_order_relaxed);
   }
 
-  Strand get_strand(int strand_id) { return Strand(*this, strand_id); }
+  /**
+   * @brief number of posts that did not need to write the eventfd because
+   * the loop was awake or a wakeup was already on its way
+   */
+  uint64_t suppressed_wakeup_count() const {
+    return suppressed_wakeup_count_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief interest changes that reached the poller
+   */
+  uint64_t update_count() const {
+    return update_count_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief timerfd_settime calls, sample it twice for a rate. A wakeup is
+   * reprogrammed only when the earliest timer group moves.
+   */
+  uint64_t timerfd_update_count() const {
+    return timerfd_update_count_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief low latency mode, call before loop(). The polling thread spins on
+   * a non blocking poll and the post queues before it blocks. The spin
+   * budget follows the observed gap between events and is capped by
+   * max_spin_us; when events are further apart the thread blocks at once.
+   *
+   * @param max_spin_us 0 turns busy polling off
+   */
+  void set_busy_poll(Timestamp max_spin_us);
+
+  /**
+   * @brief current spin budget in microseconds, 0 when not spinning
+   */
+  Timestamp busy_poll_budget() const { return spin_budget_us_; }
 
 private:
   void functors_work();
 
+  /**
+   * @brief handle the poll results of the last round nobody has taken yet,
+   * each worker takes the next index of valid_dispatchers_
+   *
+   * @return false if there was none left
+   */
+  bool run_events();
+
+  /**
+   * @brief before valid_dispatchers_ is reused: handle what is left of the
+   * last round and wait for the workers still reading an index
+   */
+  void reclaim_events();
+
+  bool run_lane(PostPriority lane);
+
+  bool run_ready_strand(PostPriority lane);
+
+  // one functor of post_unbounded(), false if none could be taken
+  bool run_unbounded();
+
+  void push_ready_strand(Strand &strand);
+
   void tick_timer();
 
+  /**
+   * @brief make the current thread the one working on queue_, true if it
+   * was not already. Never waits: false as well while another thread has
+   * them. A thread that holds the timers adds and cancels in place, the
+   * others stage; expiry is left to the next timerfd report or tick.
+   */
+  bool enter_timers();
+
+  void leave_timers();
+
+  // apply the staged adds and cancels, timers held
+  bool run_timer_ops();
+
+  // timers held
+  std::error_code update_timerfd_expire();
+
+  /**
+   * @brief called after a functor has been queued, wakes up the poller only
+   * if it is parked in poll() and no wakeup is pending yet
+   */
+  void notify_posted();
+
+  bool has_posted_work() const;
+
+  /**
+   * @brief apply the overflow policy before an unstranded post
+   */
+  std::error_code make_room();
+
+  /**
+   * @brief write the eventfd if a thread is blocked in poll() and no wakeup
+   * is pending, the caller must have published its work before
+   */
+  bool wakeup_poller();
+
+  void run_loop_hooks(LoopPhase phase);
+
+  /**
+   * @return true if the spin found events or posted functors
+   */
+  bool spin_poll(std::error_code &ec);
+
+  void update_spin_budget(Timestamp now);
+
+  void wakeup();
+
 private:
   std::unique_ptr<Poller> poller_;
   std::unique_ptr<Dispatcher> timer_dispatcher_;
@@ -163,39 +621,118 @@ private:
 #ifndef HAVE_EVENTFD
   std::unique_ptr<Dispatcher> w_event_dispatcher_;
 #endif
-  bool stop_;
-  std::unordered_map<int, Dispatcher *> valid_dispatchers_;
+  std::atomic_bool stop_;
+  bool exclusive_;
+  bool oneshot_dispatch_;
+  // oneshot dispatch: a thread is polling
+  std::atomic_bool poll_owner_;
+  // reported by the last poll, cleared but never shrunk
+  std::vector<Dispatcher *> valid_dispatchers_;
+  // the round being handed out: its size in the high 32 bits, the next
+  // index in the low ones. Poll results never go through the scheduler, so
+  // no post allocates for them and no overflow policy can drop them.
+  std::atomic<uint64_t> events_;
+  // workers between taking an index and reading its dispatcher
+  std::atomic_int event_readers_;
   TimerQueue queue_;
-
-  std::map<int, loop_callback_t> loop_callbacks_;
+  struct TimerOp {
+    TimerOp()
+        : timer_id(0), cancel(false), when(0), interval(0), slack(0),
+          callback() {}
+
+    TimerId timer_id;
+    bool cancel;
+    Timestamp when;
+    Timestamp interval;
+    Timestamp slack;
+    functor callback;
+  };
+  // adds and cancels from threads that do not hold the timers
+  light::utils::LockFreeQueue<TimerOp> timer_ops_;
+  // a thread works on queue_ and the timerfd
+  std::atomic_bool timers_busy_;
+  Timestamp timer_slack_;
+  // what the timerfd is armed with, 0 when it is not
+  Timestamp timerfd_expire_;
+
+  struct LoopHook {
+    LoopPhase phase;
+    loop_callback_t func;
+  };
+  std::map<int, LoopHook> loop_hooks_;
   int last_callback_idx_;
+  std::atomic_int loop_hook_count_[LOOP_PHASE_COUNT];
+  std::atomic_bool next_iteration_requested_;
+  // set by the polling thread when an iteration found nothing to do
+  bool idle_iteration_;
 
-  // may change to lock free queue
-  std::list<functor> post_functors_;
+  // runs unstranded functors
+  std::unique_ptr<Scheduler> scheduler_;
 
   std::atomic_int running_workers_;
   std::mutex cond_lock_;
   std::condition_variable cond_var_;
   int notify_valid_;
 
-  std::map<int, std::vector<functor>> unique_post_functors_;
-  std::mutex post_functor_lock_;
-  std::set<int> running_post_queue_ids_;
+  std::mutex loop_callback_lock_;
+
+  std::unordered_map<int, std::unique_ptr<Strand>> strands_;
+  std::mutex strand_lock_;
+  struct Lane {
+    Lane() : strands(), popping(false), count(0), skipped(0) {}
+    // runnable strands, any thread pushes, one worker at a time pops
+    light::utils::IntrusiveLockFreeQueue strands;
+    std::atomic_bool popping;
+    std::atomic<size_t> count;
+    // batches run from higher lanes while this one had work
+    std::atomic<uint32_t> skipped;
+  };
+  Lane lanes_[PRIORITY_COUNT];
+
+  // set while a thread is (about to be) blocked in poll()
+  std::atomic_bool polling_;
+  // set by the first post that writes the eventfd, cleared when poll returns
+  std::atomic_bool wakeup_pending_;
+  std::atomic<uint64_t> wakeup_count_;
+  std::atomic<uint64_t> suppressed_wakeup_count_;
+  std::atomic<uint64_t> update_count_;
+  std::atomic<uint64_t> timerfd_update_count_;
+
+  size_t capacity_;
+  OverflowPolicy overflow_policy_;
+  std::atomic<uint64_t> rejected_count_;
+  std::atomic<uint64_t> dropped_count_;
+  // see post_unbounded(), one consumer at a time, unbounded_popping_
+  light::utils::LockFreeQueue<light::utils::Task> unbounded_;
+  std::atomic_bool unbounded_popping_;
+
+  // busy polling, only touched by the polling thread once loop() runs
+  Timestamp busy_poll_max_us_;
+  Timestamp spin_budget_us_;
+  Timestamp avg_activity_gap_us_;
+  Timestamp last_activity_;
+
+  std::atomic<Timestamp> now_;
 };
 
 template <typename FUNC>
 template <typename... ARGS>
 void SafeCallWrapper<FUNC>::operator()(ARGS &&... args) {
-  looper_->strand_post(strand_id_, func_, std::forward<ARGS>(args)...);
+  if (strand_) {
+    looper_->strand_post(*strand_, func_, std::forward<ARGS>(args)...);
+  } else {
+    looper_->post(func_, std::forward<ARGS>(args)...);
+  }
 }
 
 template <typename FUNC, typename... ARGS>
-void Strand::post(FUNC func, ARGS &&... args) {
-  looper_->strand_post(strand_id_, func, std::forward<ARGS>(args)...);
+std::error_code Strand::post(FUNC &&func, ARGS &&... args) {
+  return looper_->strand_post(*this, std::forward<FUNC>(func),
+                              std::forward<ARGS>(args)...);
 }
 
 template <typename FUNC> SafeCallWrapper<FUNC> Strand::wrap(FUNC func) {
-  looper_->strand_wrap(strand_id_, func);
+  return looper_->strand_wrap(func, *this);
 }
 
 } /* network */
@@ -0,0 +1,77 @@
+#include "network/looper_group.h"
+#include "utils/logger.h"
+
+namespace light {
+namespace network {
+
+LooperGroup::LooperGroup(int looper_count, BalancePolicy policy,
+                         SchedulerType scheduler_type)
+    : members_(), policy_(policy), next_idx_(0), threads_(), placement_(),
+      first_thread_idx_(0) {
+  if (looper_count <= 0) {
+    looper_count = (std::max)(std::thread::hardware_concurrency(), 1u);
+  }
+  for (int i = 0; i < looper_count; ++i) {
+    members_.emplace_back(new Member(scheduler_type));
+    members_.back()->looper->set_exclusive(true);
+  }
+}
+
+LooperGroup::~LooperGroup() { stop(); }
+
+void LooperGroup::start() {
+  assert(threads_.empty());
+  for (size_t i = 0; i < members_.size(); ++i) {
+    Looper *looper = members_[i]->looper.get();
+    int thread_idx = first_thread_idx_ + static_cast<int>(i);
+    threads_.emplace_back([this, looper, thread_idx] {
+      auto ec = placement_.apply(thread_idx);
+      if (ec) {
+        LOG(WARNING) << "failed to place looper thread " << thread_idx << ": "
+                     << ec.message();
+      }
+      looper->loop();
+    });
+  }
+}
+
+void LooperGroup::stop() {
+  for (auto &member : members_) {
+    member->looper->stop();
+  }
+  for (auto &thd : threads_) {
+    thd.join();
+  }
+  threads_.clear();
+}
+
+Looper &LooperGroup::acquire_looper() {
+  size_t idx = 0;
+  if (policy_ == LEAST_LOAD) {
+    int min_load = members_[0]->load.load(std::memory_order_relaxed);
+    for (size_t i = 1; i < members_.size(); ++i) {
+      int load = members_[i]->load.load(std::memory_order_relaxed);
+      if (load < min_load) {
+        min_load = load;
+        idx = i;
+      }
+    }
+  } else {
+    idx = next_idx_.fetch_add(1, std::memory_order_relaxed) % members_.size();
+  }
+  members_[idx]->load.fetch_add(1, std::memory_order_relaxed);
+  return *members_[idx]->looper;
+}
+
+void LooperGroup::release_looper(Looper &looper) {
+  for (auto &member : members_) {
+    if (member->looper.get() == &looper) {
+      member->load.fetch_sub(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  assert(false);
+}
+
+} /* network */
+} /* light */
@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "network/looper.h"
+#include "utils/noncopyable.h"
+#include "utils/thread_placement.h"
+
+namespace light {
+namespace network {
+
+/**
+ * @brief a set of Loopers, each one owns its own poller and is driven by a
+ * dedicated thread. Connections are spread over the members, so no lock is
+ * shared between the threads on the io path.
+ */
+class LooperGroup : public light::utils::NonCopyable {
+public:
+  enum BalancePolicy { ROUND_ROBIN, LEAST_LOAD };
+
+public:
+  /**
+   * @param looper_count number of loopers(threads), 0 means one per core
+   * @param policy how acquire_looper() picks a member
+   * @param scheduler_type scheduler of every member looper
+   */
+  explicit LooperGroup(int looper_count = 0,
+                       BalancePolicy policy = ROUND_ROBIN,
+                       SchedulerType scheduler_type = SLICE_SCHEDULER);
+
+  ~LooperGroup();
+
+  /**
+   * @brief must be called before start(), member i runs as thread
+   * first_thread_idx + i of the placement
+   */
+  void set_placement(const light::utils::ThreadPlacement &placement,
+                     int first_thread_idx = 0) {
+    placement_ = placement;
+    first_thread_idx_ = first_thread_idx;
+  }
+
+  void start();
+
+  void stop();
+
+  bool running() const { return !threads_.empty(); }
+
+  /**
+   * @brief pick a member for a new connection and account it as one more
+   * load unit, call release_looper() when the connection is gone
+   */
+  Looper &acquire_looper();
+
+  void release_looper(Looper &looper);
+
+  size_t size() const { return members_.size(); }
+
+  Looper &get_looper(size_t idx) const { return *members_[idx]->looper; }
+
+  int get_load(size_t idx) const { return members_[idx]->load.load(); }
+
+private:
+  struct Member {
+    explicit Member(SchedulerType scheduler_type)
+        : looper(new Looper(scheduler_type)), load(0) {}
+    std::unique_ptr<Looper> looper;
+    std::atomic_int load;
+  };
+
+  std::vector<std::unique_ptr<Member>> members_;
+  BalancePolicy policy_;
+  std::atomic<uint32_t> next_idx_;
+  std::vector<std::thread> threads_;
+  light::utils::ThreadPlacement placement_;
+  int first_thread_idx_;
+};
+
+} /* network */
+} /* light */
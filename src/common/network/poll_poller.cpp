@@ -16,7 +16,7 @@ PollPoller::~PollPoller() {}
 // millisecs
 std::error_code
 PollPoller::poll(int timeout,
-                   std::unordered_map<int, Dispatcher *> &active_dispatchers) {
+                   std::vector<Dispatcher *> &active_dispatchers) {
 
   if (fds_.size() == 0) {
     ::Sleep(timeout);
@@ -34,12 +34,12 @@ PollPoller::poll(int timeout,
     for (auto it = fds_.begin(); it != fds_.end() && num_events > 0; ++it) {
       if (it->revents > 0) {
         --num_events;
-        Dispatcher *dispatcher = dispatchers_[it->fd];
+        Dispatcher *dispatcher = dispatchers_.find(it->fd);
         dispatcher->set_poll_event_data(
             it->revents & (POLLIN | POLLPRI), it->revents & POLLOUT,
             it->revents & POLLERR,
             (it->revents & POLLHUP) && !(it->revents & POLLIN));
-        active_dispatchers[dispatcher->get_fd()] = dispatcher;
+        active_dispatchers.push_back(dispatcher);
       }
     }
   }
@@ -47,7 +47,7 @@ PollPoller::poll(int timeout,
 }
 
 std::error_code PollPoller::add_dispatcher(Dispatcher &dispatcher) {
-  assert(dispatchers_.find(dispatcher.get_fd()) == dispatchers_.end());
+  assert(!dispatchers_.find(dispatcher.get_fd()));
   int sock = dispatcher.get_fd();
 
   struct pollfd pd;
@@ -64,20 +64,20 @@ std::error_code PollPoller::add_dispatcher(Dispatcher &dispatcher) {
   dispatcher.set_index(fds_.size());
   fds_.push_back(pd);
 
-  dispatchers_[dispatcher.get_fd()] = &dispatcher;
+  dispatchers_.insert(dispatcher);
   return LS_OK_ERROR();
 }
 
 std::error_code
 PollPoller::remove_dispatcher(Dispatcher &dispatcher) {
-  assert(dispatchers_.find(dispatcher.get_fd()) != dispatchers_.end());
+  assert(dispatchers_.find(dispatcher.get_fd()) == &dispatcher);
 
   int sock = dispatcher.get_fd();
 
   int vec_idx = dispatcher.get_index();
-  if (dispatchers_.size() > 1) {
+  if (fds_.size() > 1) {
     fds_[vec_idx] = fds_[fds_.size() - 1];
-    auto tgt_disp = dispatchers_[fds_[vec_idx].fd];
+    auto tgt_disp = dispatchers_.find(fds_[vec_idx].fd);
     tgt_disp->set_index(vec_idx);
     fds_.pop_back();
   } else {
@@ -90,7 +90,7 @@ PollPoller::remove_dispatcher(Dispatcher &dispatcher) {
 
 std::error_code
 PollPoller::update_dispatcher(Dispatcher &dispatcher) {
-  assert(dispatchers_.find(dispatcher.get_fd()) != dispatchers_.end());
+  assert(dispatchers_.find(dispatcher.get_fd()) == &dispatcher);
   int sock = dispatcher.get_fd();
 
   struct pollfd &pd = fds_[dispatcher.get_index()];
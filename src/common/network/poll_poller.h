@@ -17,7 +17,7 @@ public:
   virtual ~PollPoller();
 
   std::error_code
-  poll(int timeout, std::unordered_map<int, Dispatcher *> &active_dispatchers);
+  poll(int timeout, std::vector<Dispatcher *> &active_dispatchers);
 
   std::error_code add_dispatcher(Dispatcher &dispatcher);
 
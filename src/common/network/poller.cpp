@@ -1,5 +1,6 @@
 #include "network/poller.h"
 #include "network/epoll_poller.h"
+#include "network/io_uring_poller.h"
 #include "network/kqueue_poller.h"
 #include "network/poll_poller.h"
 namespace light {
@@ -8,6 +9,14 @@ Poller::~Poller() {}
 
 Poller *Poller::create_default_poller(Looper &looper) {
 
+#ifdef HAVE_IO_URING
+  try {
+    return new IoUringPoller(looper);
+  } catch (const light::exception::EventException &) {
+    // built with io_uring, running on a kernel without it (or with it
+    // disabled), epoll is there since 2.6
+  }
+#endif
 #ifdef HAVE_EPOLL_H
   return new EpollPoller(looper);
 #elif defined(HAVE_KQUEUE_H)
@@ -18,8 +27,7 @@ Poller *Poller::create_default_poller(Looper &looper) {
 }
 
 bool Poller::has_dispathcer(const Dispatcher &dispatcher) const {
-  auto res = dispatchers_.find(dispatcher.get_fd());
-  return res != dispatchers_.end() && &dispatcher == res->second;
+  return dispatchers_.find(dispatcher.get_fd()) == &dispatcher;
 }
 } /* network */
 } /* light */
@@ -1,20 +1,107 @@
 #pragma once
-#include <unordered_map>
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
 #include "network/dispatcher.h"
 #include "utils/noncopyable.h"
 namespace light {
 namespace network {
 class Looper;
 
+/**
+ * @brief dispatchers of a poller indexed by fd. Fds are small and dense, a
+ * flat array grown on demand beats hashing on every event.
+ *
+ * Every slot carries a generation bumped each time the fd is registered, a
+ * backend that hands the kernel tag(fd, generation) instead of a pointer
+ * can tell an event of a closed and reused fd from one of the current
+ * registration.
+ */
+class DispatcherTable {
+public:
+  DispatcherTable() : slots_(), size_(0) {}
+
+  /**
+   * @return the generation of the new registration
+   */
+  uint32_t insert(Dispatcher &dispatcher) {
+    size_t fd = static_cast<size_t>(dispatcher.get_fd());
+    if (fd >= slots_.size())
+      slots_.resize((std::max)(fd + 1, slots_.size() * 2));
+    Slot &slot = slots_[fd];
+    if (!slot.dispatcher)
+      ++size_;
+    slot.dispatcher = &dispatcher;
+    return ++slot.generation;
+  }
+
+  void erase(int fd) {
+    if (fd >= 0 && static_cast<size_t>(fd) < slots_.size() &&
+        slots_[fd].dispatcher) {
+      slots_[fd].dispatcher = nullptr;
+      --size_;
+    }
+  }
+
+  Dispatcher *find(int fd) const {
+    return fd >= 0 && static_cast<size_t>(fd) < slots_.size()
+               ? slots_[fd].dispatcher
+               : nullptr;
+  }
+
+  /**
+   * @return nullptr if the fd was removed or registered again since
+   */
+  Dispatcher *find(int fd, uint32_t generation) const {
+    Dispatcher *dispatcher = find(fd);
+    return dispatcher && slots_[fd].generation == generation ? dispatcher
+                                                             : nullptr;
+  }
+
+  uint32_t generation(int fd) const {
+    return find(fd) ? slots_[fd].generation : 0;
+  }
+
+  size_t size() const { return size_; }
+
+  static uint64_t tag(int fd, uint32_t generation) {
+    return static_cast<uint64_t>(generation) << 32 | static_cast<uint32_t>(fd);
+  }
+
+  static int tag_fd(uint64_t tag) {
+    return static_cast<int>(static_cast<uint32_t>(tag));
+  }
+
+  static uint32_t tag_generation(uint64_t tag) {
+    return static_cast<uint32_t>(tag >> 32);
+  }
+
+private:
+  struct Slot {
+    Slot() : dispatcher(nullptr), generation(0) {}
+    Dispatcher *dispatcher;
+    uint32_t generation;
+  };
+
+  std::vector<Slot> slots_;
+  size_t size_;
+};
+
 class Poller : light::utils::NonCopyable {
 public:
-  Poller(Looper &looper) : dispatchers_(), looper_(&looper) { UNUSED(looper_); }
+  Poller(Looper &looper)
+      : dispatchers_(), round_(0), looper_(&looper) {
+    UNUSED(looper_);
+  }
 
   virtual ~Poller();
 
+  /**
+   * @brief append the dispatchers with events to active_dispatchers, each
+   * at most once. The caller clears it, reusing its capacity.
+   */
   virtual std::error_code
-  poll(int timeout,
-       std::unordered_map<int, Dispatcher *> &active_dispatchers) = 0;
+  poll(int timeout, std::vector<Dispatcher *> &active_dispatchers) = 0;
 
   virtual std::error_code add_dispatcher(Dispatcher &dispatcher) = 0;
 
@@ -22,12 +109,41 @@ public:
 
   virtual std::error_code update_dispatcher(Dispatcher &dispatcher) = 0;
 
+  /**
+   * @brief false if edge triggered dispatchers are polled level triggered
+   */
+  virtual bool edge_triggered_supported() const { return false; }
+
+  /**
+   * @brief false if Dispatcher::set_oneshot() is ignored
+   */
+  virtual bool oneshot_supported() const { return false; }
+
+  /**
+   * @brief arm a oneshot dispatcher again after its events were handled
+   */
+  virtual std::error_code rearm_dispatcher(Dispatcher &dispatcher) {
+    return update_dispatcher(dispatcher);
+  }
+
   bool has_dispathcer(const Dispatcher &dispatcher) const;
 
   static Poller *create_default_poller(Looper &looper);
 
 protected:
-  std::unordered_map<int, Dispatcher *> dispatchers_;
+  /**
+   * @brief for backends that may report a fd several times per poll(),
+   * merges the events of one round into a single entry
+   */
+  void report(Dispatcher &dispatcher, bool r, bool w, bool e, bool c,
+              std::vector<Dispatcher *> &active_dispatchers, bool h = false) {
+    if (dispatcher.merge_poll_event_data(round_, r, w, e, c, h))
+      active_dispatchers.push_back(&dispatcher);
+  }
+
+  DispatcherTable dispatchers_;
+  // bumped by poll() implementations that use report()
+  uint64_t round_;
 
 private:
   Looper *looper_;
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <thread>
+#include "network/scheduler.h"
+
+namespace light {
+namespace network {
+
+using light::utils::Task;
+
+namespace {
+struct WorkerSlot {
+  const Scheduler *owner;
+  void *worker;
+};
+thread_local WorkerSlot current_slot = {nullptr, nullptr};
+
+size_t slice_count(size_t total, size_t workers) {
+  return (std::max)(total / (std::max)(workers, static_cast<size_t>(1)),
+                    static_cast<size_t>(1));
+}
+} /* anonymous */
+
+Scheduler::~Scheduler() {}
+
+Scheduler *Scheduler::create_scheduler(SchedulerType type) {
+  switch (type) {
+  case WORK_STEALING_SCHEDULER:
+    return new WorkStealingScheduler;
+  case SLICE_SCHEDULER:
+  default:
+    return new SliceScheduler;
+  }
+}
+
+size_t Scheduler::size() const {
+  size_t total = 0;
+  for (int lane = 0; lane < PRIORITY_COUNT; ++lane) {
+    total += size(static_cast<PostPriority>(lane));
+  }
+  return total;
+}
+
+size_t Scheduler::LaneQueue::run_slice(size_t workers) {
+  if (queue.empty())
+    return 0;
+  if (popping.exchange(true, std::memory_order_acquire))
+    return 0;
+  size_t count = slice_count(queue.size(), workers);
+  std::vector<Task> slice;
+  Task task;
+  while (slice.size() < count && queue.pop_front(task)) {
+    slice.emplace_back(std::move(task));
+  }
+  popping.store(false, std::memory_order_release);
+
+  for (auto &v : slice) {
+    v();
+  }
+  return slice.size();
+}
+
+bool Scheduler::LaneQueue::drop_front() {
+  if (popping.exchange(true, std::memory_order_acquire))
+    return false;
+  bool dropped = queue.pop_front();
+  popping.store(false, std::memory_order_release);
+  return dropped;
+}
+
+// SliceScheduler
+void SliceScheduler::post(Task &&task, PostPriority priority) {
+  lanes_[priority].queue.push_back(std::move(task));
+}
+
+size_t SliceScheduler::run_batch(PostPriority lane) {
+  return lanes_[lane].run_slice(std::thread::hardware_concurrency());
+}
+
+// WorkStealingScheduler
+WorkStealingScheduler::WorkStealingScheduler()
+    : injection_(), injection_popping_(false), worker_count_(0),
+      worker_lock_() {}
+
+WorkStealingScheduler::~WorkStealingScheduler() {
+  Task *func;
+  while (injection_.pop_front(func)) {
+    delete func;
+  }
+  int count = worker_count_.load();
+  for (int i = 0; i < count; ++i) {
+    while (workers_[i]->deque.take(func)) {
+      delete func;
+    }
+  }
+}
+
+WorkStealingScheduler::Worker *
+WorkStealingScheduler::current_worker() const {
+  if (current_slot.owner != this)
+    return nullptr;
+  return static_cast<Worker *>(current_slot.worker);
+}
+
+void WorkStealingScheduler::enter_worker() {
+  assert(current_slot.owner == nullptr);
+  std::lock_guard<std::mutex> lock(worker_lock_);
+  Worker *worker = nullptr;
+  int count = worker_count_.load(std::memory_order_relaxed);
+  for (int i = 0; i < count; ++i) {
+    // reuse a deque left by a thread that quit the loop
+    if (!workers_[i]->owned.load()) {
+      worker = workers_[i].get();
+      break;
+    }
+  }
+  if (worker == nullptr) {
+    assert(count < MAX_WORKERS);
+    workers_[count].reset(new Worker);
+    worker = workers_[count].get();
+    worker->victim = count;
+    worker_count_.store(count + 1, std::memory_order_release);
+  }
+  worker->owned.store(true);
+  current_slot.owner = this;
+  current_slot.worker = worker;
+}
+
+void WorkStealingScheduler::leave_worker() {
+  Worker *worker = current_worker();
+  if (worker == nullptr)
+    return;
+  // pending functors stay in the deque, other workers steal them
+  std::lock_guard<std::mutex> lock(worker_lock_);
+  worker->owned.store(false);
+  current_slot.owner = nullptr;
+  current_slot.worker = nullptr;
+}
+
+void WorkStealingScheduler::post(Task &&task, PostPriority priority) {
+  if (priority != PRIORITY_NORMAL) {
+    lanes_[priority].queue.push_back(std::move(task));
+    return;
+  }
+  Task *node = new Task(std::move(task));
+  Worker *worker = current_worker();
+  if (worker) {
+    worker->deque.push(node);
+  } else {
+    injection_.push_back(node);
+  }
+}
+
+void WorkStealingScheduler::run(Task *task) {
+  std::unique_ptr<Task> holder(task);
+  (*holder)();
+}
+
+size_t WorkStealingScheduler::run_batch(PostPriority lane) {
+  if (lane != PRIORITY_NORMAL)
+    return lanes_[lane].run_slice(worker_count_.load());
+
+  Worker *worker = current_worker();
+  if (worker == nullptr)
+    return 0;
+
+  size_t executed = 0;
+  Task *func;
+  while (executed < LOCAL_BATCH && worker->deque.take(func)) {
+    run(func);
+    ++executed;
+  }
+  if (executed)
+    return executed;
+
+  executed = run_injected(*worker);
+  if (executed)
+    return executed;
+
+  return steal(*worker);
+}
+
+size_t WorkStealingScheduler::run_injected(Worker &worker) {
+  if (injection_.empty())
+    return 0;
+  if (injection_popping_.exchange(true, std::memory_order_acquire))
+    return 0;
+  // move a share of the injected functors to our deque so that idle
+  // workers can steal them from us
+  size_t count = slice_count(injection_.size(), worker_count_.load());
+  Task *first = nullptr;
+  Task *func;
+  for (size_t i = 0; i < count && injection_.pop_front(func); ++i) {
+    if (first == nullptr) {
+      first = func;
+    } else {
+      worker.deque.push(func);
+    }
+  }
+  injection_popping_.store(false, std::memory_order_release);
+
+  if (first == nullptr)
+    return 0;
+  run(first);
+  return 1;
+}
+
+size_t WorkStealingScheduler::steal(Worker &worker) {
+  int count = worker_count_.load(std::memory_order_acquire);
+  Task *func;
+  for (int i = 0; i < count; ++i) {
+    worker.victim = (worker.victim + 1) % count;
+    Worker *victim = workers_[worker.victim].get();
+    if (victim == &worker)
+      continue;
+    if (victim->deque.steal(func)) {
+      run(func);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+bool WorkStealingScheduler::drop_oldest(PostPriority lane) {
+  if (lane != PRIORITY_NORMAL)
+    return lanes_[lane].drop_front();
+
+  Task *task = nullptr;
+  if (!injection_popping_.exchange(true, std::memory_order_acquire)) {
+    injection_.pop_front(task);
+    injection_popping_.store(false, std::memory_order_release);
+  }
+  // nothing injected, take the oldest functor of some worker
+  int count = worker_count_.load(std::memory_order_acquire);
+  for (int i = 0; task == nullptr && i < count; ++i) {
+    workers_[i]->deque.steal(task);
+  }
+  if (task == nullptr)
+    return false;
+  delete task;
+  return true;
+}
+
+size_t WorkStealingScheduler::size(PostPriority lane) const {
+  if (lane != PRIORITY_NORMAL)
+    return lanes_[lane].queue.size();
+  size_t total = injection_.size();
+  int count = worker_count_.load(std::memory_order_acquire);
+  for (int i = 0; i < count; ++i) {
+    total += workers_[i]->deque.size();
+  }
+  return total;
+}
+
+} /* network */
+} /* light */
@@ -0,0 +1,177 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "network/timer.h"
+#include "utils/lockfree_queue.h"
+#include "utils/noncopyable.h"
+#include "utils/task.h"
+#include "utils/work_stealing_deque.h"
+
+namespace light {
+namespace network {
+
+enum SchedulerType { SLICE_SCHEDULER, WORK_STEALING_SCHEDULER };
+
+/**
+ * @brief lane of a posted functor, lanes are drained from PRIORITY_HIGH to
+ * PRIORITY_LOW, see Looper::post()
+ */
+enum PostPriority {
+  PRIORITY_HIGH,
+  PRIORITY_NORMAL,
+  PRIORITY_LOW,
+  PRIORITY_COUNT
+};
+
+/**
+ * @brief runs the unstranded functors posted to a Looper. Every thread in
+ * Looper::loop() is a worker, it calls enter_worker() once and then
+ * run_batch() whenever it is woken up.
+ */
+class Scheduler : public light::utils::NonCopyable {
+public:
+  virtual ~Scheduler();
+
+  /**
+   * @brief thread safe
+   */
+  virtual void post(light::utils::Task &&task,
+                    PostPriority priority = PRIORITY_NORMAL) = 0;
+
+  /**
+   * @brief run some of the pending functors of one lane on the calling
+   * worker, picking the lane is up to the caller
+   *
+   * @return number of functors executed, 0 if nothing could be taken
+   */
+  virtual size_t run_batch(PostPriority lane = PRIORITY_NORMAL) = 0;
+
+  /**
+   * @brief approximate number of pending functors in a lane
+   */
+  virtual size_t size(PostPriority lane) const = 0;
+
+  /**
+   * @brief destroy the oldest pending functor of a lane without running it,
+   * any thread
+   *
+   * @return false if nothing could be taken
+   */
+  virtual bool drop_oldest(PostPriority lane) = 0;
+
+  /**
+   * @brief approximate number of pending functors in all lanes
+   */
+  size_t size() const;
+
+  virtual void enter_worker() {}
+
+  virtual void leave_worker() {}
+
+  static Scheduler *create_scheduler(SchedulerType type);
+
+protected:
+  /**
+   * @brief shared queue of one lane, workers take turns cutting a slice of
+   * size() / workers functors
+   */
+  struct LaneQueue {
+    LaneQueue() : queue(), popping(false) {}
+
+    size_t run_slice(size_t workers);
+
+    bool drop_front();
+
+    // single consumer queue, guarded by popping
+    light::utils::LockFreeQueue<light::utils::Task> queue;
+    std::atomic_bool popping;
+  };
+};
+
+/**
+ * @brief one shared queue per lane, a worker cuts a slice of
+ * size() / hardware_concurrency() functors at a time. Functors start in post
+ * order, the default of Looper.
+ */
+class SliceScheduler : public Scheduler {
+public:
+  void post(light::utils::Task &&task,
+            PostPriority priority = PRIORITY_NORMAL);
+
+  size_t run_batch(PostPriority lane = PRIORITY_NORMAL);
+
+  size_t size(PostPriority lane) const { return lanes_[lane].queue.size(); }
+
+  using Scheduler::size;
+
+  bool drop_oldest(PostPriority lane) { return lanes_[lane].drop_front(); }
+
+private:
+  LaneQueue lanes_[PRIORITY_COUNT];
+};
+
+/**
+ * @brief every worker owns a Chase-Lev deque, functors posted by a worker go
+ * to its own deque and are run LIFO, idle workers steal FIFO from the others.
+ * Functors posted from threads outside the looper go through a shared
+ * injection queue. Only the normal lane is work stealing, the high and low
+ * lanes are plain shared queues.
+ *
+ * Opt-in: a loop thread's own posts run newest first rather than in post
+ * order, and every normal lane post allocates its deque node.
+ */
+class WorkStealingScheduler : public Scheduler {
+public:
+  enum { MAX_WORKERS = 256, LOCAL_BATCH = 16 };
+
+  WorkStealingScheduler();
+
+  ~WorkStealingScheduler();
+
+  void post(light::utils::Task &&task,
+            PostPriority priority = PRIORITY_NORMAL);
+
+  size_t run_batch(PostPriority lane = PRIORITY_NORMAL);
+
+  size_t size(PostPriority lane) const;
+
+  using Scheduler::size;
+
+  bool drop_oldest(PostPriority lane);
+
+  void enter_worker();
+
+  void leave_worker();
+
+private:
+  struct Worker {
+    Worker() : deque(), owned(false), victim(0) {}
+    light::utils::WorkStealingDeque<light::utils::Task *> deque;
+    std::atomic_bool owned;
+    size_t victim;
+  };
+
+  Worker *current_worker() const;
+
+  size_t run_injected(Worker &worker);
+
+  size_t steal(Worker &worker);
+
+  static void run(light::utils::Task *task);
+
+private:
+  light::utils::LockFreeQueue<light::utils::Task *> injection_;
+  std::atomic_bool injection_popping_;
+
+  std::unique_ptr<Worker> workers_[MAX_WORKERS];
+  std::atomic_int worker_count_;
+  std::mutex worker_lock_;
+
+  // PRIORITY_HIGH and PRIORITY_LOW, the normal slot is unused
+  LaneQueue lanes_[PRIORITY_COUNT];
+};
+
+} /* network */
+} /* light */
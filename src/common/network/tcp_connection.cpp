@@ -1,12 +1,25 @@
+#include "network/looper.h"
 #include "network/tcp_connection.h"
 namespace light {
 namespace network {
 
 TcpConnection::TcpConnection(Looper &looper)
-    : TcpSocket(), Connection(looper), write_buffer_(), bytes_has_read_(0) {}
+    : TcpSocket(), Connection(looper), write_buffer_(), bytes_has_read_(0),
+      edge_triggered_(false), read_ready_(false), draining_(false),
+      read_buf_(nullptr), read_len_(0), read_min_(0), read_handler_(),
+      streaming_(false), stream_handler_(), stream_buf_(STREAM_BUFFER_SIZE),
+      chunk_len_(0), chunk_alloc_(), chunk_release_(), chunk_handler_(),
+      chunk_(nullptr), destroyed_(nullptr), io_guard_(std::make_shared<IoGuard>(this)),
+      deadline_entry_() {}
 
 TcpConnection::TcpConnection(Looper &looper, int fd)
-    : TcpSocket(fd), Connection(looper), write_buffer_(), bytes_has_read_(0) {
+    : TcpSocket(fd), Connection(looper), write_buffer_(), bytes_has_read_(0),
+      edge_triggered_(false), read_ready_(false), draining_(false),
+      read_buf_(nullptr), read_len_(0), read_min_(0), read_handler_(),
+      streaming_(false), stream_handler_(), stream_buf_(STREAM_BUFFER_SIZE),
+      chunk_len_(0), chunk_alloc_(), chunk_release_(), chunk_handler_(),
+      chunk_(nullptr), destroyed_(nullptr), io_guard_(std::make_shared<IoGuard>(this)),
+      deadline_entry_() {
   dispatcher_.reset(new Dispatcher(looper, fd));
   auto ec = this->set_nonblocking();
   if (ec)
@@ -16,11 +29,25 @@ TcpConnection::TcpConnection(Looper &looper, int fd)
 }
 
 TcpConnection::~TcpConnection() {
+  {
+    std::lock_guard<std::recursive_mutex> lk(io_guard_->lock);
+    io_guard_->conn = nullptr;
+  }
+  if (destroyed_)
+    *destroyed_ = true;
+  if (chunk_)
+    chunk_release_(chunk_);
   if (dispatcher_)
     dispatcher_->detach();
 }
 
 void TcpConnection::buffer_write_callback() {
+  if (edge_triggered_) {
+    std::shared_ptr<IoGuard> guard(io_guard_);
+    std::lock_guard<std::recursive_mutex> lk(guard->lock);
+    drain_write();
+    return;
+  }
   assert(write_buffer_.size());
 
   auto &vec = write_buffer_.get_iovec();
@@ -36,21 +63,266 @@ void TcpConnection::buffer_write_callback() {
     if (!write_buffer_.size()) {
       dispatcher_->disable_write();
     }
+    on_write_progress();
   }
 }
 
 std::error_code TcpConnection::close() {
+  deadline_entry_.detach();
   dispatcher_->detach();
   return TcpSocket::close();
 }
 
 void TcpConnection::async_write(void *buf, size_t len,
                                 const write_callback_t &func) {
+  std::unique_lock<std::recursive_mutex> lk;
+  if (edge_triggered_)
+    lk = std::unique_lock<std::recursive_mutex>(io_guard_->lock);
   auto old_size = write_buffer_.size();
   write_buffer_.append(buf, len, func);
   if (!old_size) {
-    dispatcher_->enable_write();
+    deadline_entry_.refresh(Deadlines::WRITE);
+    // edge triggered: the socket is writable until a write says otherwise
+    if (edge_triggered_)
+      drain_write();
+    else
+      dispatcher_->enable_write();
+  }
+}
+
+void TcpConnection::set_deadlines(Deadlines &deadlines,
+                                  const Deadlines::callback_t &callback) {
+  deadlines.attach(deadline_entry_, callback);
+  deadline_entry_.refresh(Deadlines::IDLE);
+  deadline_entry_.refresh(Deadlines::READ);
+  if (write_buffer_.size())
+    deadline_entry_.refresh(Deadlines::WRITE);
+}
+
+void TcpConnection::on_write_progress() {
+  if (!deadline_entry_.attached())
+    return;
+  deadline_entry_.refresh(Deadlines::IDLE);
+  if (write_buffer_.size())
+    deadline_entry_.refresh(Deadlines::WRITE);
+  else
+    deadline_entry_.stop(Deadlines::WRITE);
+}
+
+std::error_code TcpConnection::set_edge_triggered() {
+  if (!dispatcher_)
+    return LS_GENERIC_ERROR(EBADF);
+  if (!get_looper().edge_triggered_supported())
+    return LS_GENERIC_ERROR(ENOTSUP);
+  edge_triggered_ = true;
+  dispatcher_->set_edge_triggered(true);
+  dispatcher_->set_read_callback(
+      std::bind(&TcpConnection::handle_edge_read, this));
+  dispatcher_->enable_all();
+  return LS_OK_ERROR();
+}
+
+void TcpConnection::start_edge_read(void *read_buf, size_t buf_len,
+                                    size_t min_bytes,
+                                    read_handler_t &&handler) {
+  std::lock_guard<std::recursive_mutex> lk(io_guard_->lock);
+  read_buf_ = read_buf;
+  read_len_ = buf_len;
+  read_min_ = min_bytes;
+  bytes_has_read_ = 0;
+  read_handler_ = std::move(handler);
+  // data that came in while nobody was reading gets no new edge
+  if (read_ready_ && !draining_)
+    post_step(&TcpConnection::drain_read);
+}
+
+void TcpConnection::post_step(step_t step) {
+  std::shared_ptr<IoGuard> guard(io_guard_);
+  get_looper().post([guard, step] {
+    std::lock_guard<std::recursive_mutex> lk(guard->lock);
+    if (guard->conn)
+      (guard->conn->*step)();
+  });
+}
+
+void TcpConnection::handle_edge_read() {
+  // a handler may delete the connection, the guard outlives it
+  std::shared_ptr<IoGuard> guard(io_guard_);
+  std::lock_guard<std::recursive_mutex> lk(guard->lock);
+  read_ready_ = true;
+  if (streaming_)
+    drain_stream();
+  else
+    drain_read();
+}
+
+void TcpConnection::start_reading(stream_handler_t handler) {
+  std::lock_guard<std::recursive_mutex> lk(io_guard_->lock);
+  stream_handler_ = std::move(handler);
+  start_streaming();
+}
+
+void TcpConnection::start_reading(size_t chunk_len, chunk_alloc_t alloc,
+                                  chunk_release_t release,
+                                  chunk_handler_t handler) {
+  std::lock_guard<std::recursive_mutex> lk(io_guard_->lock);
+  chunk_len_ = chunk_len;
+  chunk_alloc_ = std::move(alloc);
+  chunk_release_ = std::move(release);
+  chunk_handler_ = std::move(handler);
+  start_streaming();
+}
+
+void TcpConnection::start_streaming() {
+  streaming_ = true;
+  if (edge_triggered_) {
+    // data that came in while nobody was reading gets no new edge
+    if (read_ready_ && !draining_)
+      post_step(&TcpConnection::drain_stream);
+    return;
+  }
+  dispatcher_->set_read_callback(
+      std::bind(&TcpConnection::drain_stream, this));
+  dispatcher_->enable_read();
+}
+
+void TcpConnection::stop_reading() {
+  std::lock_guard<std::recursive_mutex> lk(io_guard_->lock);
+  streaming_ = false;
+  if (!edge_triggered_)
+    dispatcher_->disable_read();
+  // drain_stream() lets go of a running handler once it returns
+  if (!draining_)
+    reset_streaming();
+}
+
+void TcpConnection::reset_streaming() {
+  stream_handler_ = nullptr;
+  chunk_handler_ = nullptr;
+  if (chunk_) {
+    chunk_release_(chunk_);
+    chunk_ = nullptr;
+  }
+}
+
+void TcpConnection::drain_stream() {
+  bool destroyed = false;
+  destroyed_ = &destroyed;
+  draining_ = true;
+  for (int i = 0; i < EDGE_BUDGET && streaming_; ++i) {
+    struct iovec iov[2];
+    int count = 1;
+    if (chunk_handler_) {
+      if (!chunk_)
+        chunk_ = chunk_alloc_();
+      iov[0].iov_base = chunk_;
+      iov[0].iov_len = chunk_len_;
+    } else {
+      count = stream_buf_.prepare(iov, STREAM_MIN_READ);
+    }
+    size_t room = iov[0].iov_len + (count > 1 ? iov[1].iov_len : 0);
+    ssize_t read_bytes = ::readv(this->sockfd_, iov, count);
+    std::error_code ec;
+    if (read_bytes < 0) {
+      if (SOCK_ERRNO() == EAGAIN || SOCK_ERRNO() == CERR(EWOULDBLOCK)) {
+        read_ready_ = false;
+        break;
+      }
+      ec = LS_GENERIC_ERROR(SOCK_ERRNO());
+    } else if (read_bytes == 0) {
+      ec = LS_MISC_ERR_OBJ(eof);
+    } else {
+      if (!chunk_handler_)
+        stream_buf_.commit(read_bytes);
+      on_read_progress();
+    }
+    if (ec)
+      stop_reading();
+    if (chunk_handler_) {
+      char *chunk = nullptr;
+      if (!ec)
+        std::swap(chunk, chunk_);
+      chunk_handler_(ec, chunk, ec ? 0 : read_bytes);
+    } else {
+      stream_handler_(ec, stream_buf_);
+    }
+    if (destroyed)
+      return;
+    // level triggered: a short read emptied the socket, the next event
+    // tells when there is more
+    if (!edge_triggered_ && !ec && static_cast<size_t>(read_bytes) < room)
+      break;
+  }
+  destroyed_ = nullptr;
+  draining_ = false;
+  if (!streaming_) {
+    reset_streaming();
+  } else if (edge_triggered_ && read_ready_) {
+    // budget spent with data left, let the other connections run first
+    post_step(&TcpConnection::drain_stream);
+    return;
+  }
+  stream_buf_.trim();
+}
+
+void TcpConnection::drain_read() {
+  bool destroyed = false;
+  destroyed_ = &destroyed;
+  draining_ = true;
+  for (int i = 0; i < EDGE_BUDGET && read_ready_ && read_handler_; ++i) {
+    ssize_t read_bytes =
+        ::recv(this->sockfd_, static_cast<char *>(read_buf_) + bytes_has_read_,
+               read_len_ - bytes_has_read_, 0);
+    std::error_code ec;
+    if (read_bytes < 0) {
+      if (SOCK_ERRNO() == EAGAIN || SOCK_ERRNO() == CERR(EWOULDBLOCK)) {
+        read_ready_ = false;
+        break;
+      }
+      ec = LS_GENERIC_ERROR(SOCK_ERRNO());
+    } else if (read_bytes == 0) {
+      // eof stays readable, a later read gets it too
+      ec = LS_MISC_ERR_OBJ(eof);
+    } else {
+      bytes_has_read_ += read_bytes;
+      on_read_progress();
+      if (bytes_has_read_ < read_min_)
+        continue;
+    }
+    size_t transferred = ec ? 0 : bytes_has_read_;
+    bytes_has_read_ = 0;
+    read_handler_t handler(std::move(read_handler_));
+    read_handler_ = nullptr;
+    // may start the next read, picked up by this loop
+    handler(ec, transferred);
+    if (destroyed)
+      return;
+    if (ec)
+      break;
+  }
+  destroyed_ = nullptr;
+  draining_ = false;
+  // budget spent with data left, let the other connections run first
+  if (read_ready_ && read_handler_)
+    post_step(&TcpConnection::drain_read);
+}
+
+void TcpConnection::drain_write() {
+  for (int i = 0; i < EDGE_BUDGET && write_buffer_.size(); ++i) {
+    auto &vec = write_buffer_.get_iovec();
+    ssize_t written = ::writev(get_sockfd(), &vec[0], vec.size());
+    if (written < 0) {
+      // the next EPOLLOUT edge resumes
+      if (SOCK_ERRNO() != EAGAIN && SOCK_ERRNO() != CERR(EWOULDBLOCK))
+        LOG(WARNING) << "write failed: "
+                     << LS_GENERIC_ERROR(SOCK_ERRNO()).message();
+      return;
+    }
+    write_buffer_.shift(written);
+    on_write_progress();
   }
+  if (write_buffer_.size())
+    post_step(&TcpConnection::drain_write);
 }
 
 std::error_code
@@ -1,11 +1,15 @@
 #pragma once
 #include "config.h"
 #include <deque>
+#include <memory>
+#include <mutex>
 #ifdef HAVE_SYS_UIO_H
 #include <sys/uio.h>
 #endif
 #include <stdint.h>
+#include <vector>
 #include "network/connection.h"
+#include "network/deadlines.h"
 #include "network/dispatcher.h"
 #include "network/socket.h"
 namespace light {
@@ -27,10 +31,78 @@ public:
 
   std::error_code close();
 
+  /**
+   * @brief switch to edge triggered I/O. Read and write interest are
+   * registered once for the life of the connection instead of toggled
+   * around every read and write, the callbacks drain the socket until
+   * EAGAIN. A single event does at most EDGE_BUDGET reads or writes, the
+   * rest is posted to the looper so other connections get their turn.
+   * Call it before the first read or write.
+   *
+   * @return ENOTSUP if the poller of the looper is level triggered only
+   */
+  std::error_code set_edge_triggered();
+
+  bool edge_triggered() const { return edge_triggered_; }
+
   template <typename T> void set_error_callback(T &&t);
 
   template <typename T> void set_close_callback(T &&t);
 
+  /**
+   * @brief see Dispatcher::set_half_close_callback()
+   */
+  template <typename T> void set_half_close_callback(T &&t);
+
+  /**
+   * @brief keep the idle, read and write deadlines of the connection in
+   * deadlines, which belongs to the looper of the connection. Received data
+   * refreshes idle and read, written data idle and write; the write
+   * deadline only runs while data is queued. Call it from the looper, the
+   * connection stays open when a deadline runs out.
+   */
+  void set_deadlines(Deadlines &deadlines,
+                     const Deadlines::callback_t &callback);
+
+  typedef std::function<void(const std::error_code &, ReadBuffer &)>
+      stream_handler_t;
+
+  /**
+   * @brief streaming read mode. The read callback is installed once and
+   * read interest stays on, every readiness event reads into the ring of
+   * the connection, one readv() per read, until the socket is drained or
+   * EDGE_BUDGET reads are done, and hands the ring to handler after each
+   * read. handler consumes what it used, the rest waits for more data. The
+   * ring grows while it holds too little room and shrinks back once the
+   * connection goes quiet. An error, eof included, is the last call. Don't
+   * mix it with async_read() or async_read_some(), and don't call it from
+   * handler.
+   */
+  void start_reading(stream_handler_t handler);
+
+  typedef std::function<void(const std::error_code &, char *, size_t)>
+      chunk_handler_t;
+  typedef std::function<char *()> chunk_alloc_t;
+  typedef std::function<void(char *)> chunk_release_t;
+
+  /**
+   * @brief streaming read mode without the ring, for a consumer that passes
+   * raw bytes on in buffers of its own. Every read goes straight into a
+   * chunk of chunk_len bytes from alloc, handler takes the chunk with the
+   * bytes read and owns it from then on. A chunk that got no data is kept
+   * for the next read and goes to release once reading stops. An error
+   * passes a null chunk, the rest is as in start_reading(stream_handler_t).
+   */
+  void start_reading(size_t chunk_len, chunk_alloc_t alloc,
+                     chunk_release_t release, chunk_handler_t handler);
+
+  /**
+   * @brief leave streaming mode, handler may call it
+   */
+  void stop_reading();
+
+  bool reading() const { return streaming_; }
+
   template <typename ReadCallback>
   void async_read(void *read_buf, size_t bytes_to_read, ReadCallback cb);
 
@@ -42,11 +114,81 @@ public:
   std::error_code
   get_peer_endpoint(light::network::INetEndPoint &endpoint);
 
+  // the ring starts at STREAM_BUFFER_SIZE and grows when a read would get
+  // less than STREAM_MIN_READ bytes of room
+  enum {
+    EDGE_BUDGET = 16,
+    STREAM_BUFFER_SIZE = 16384,
+    STREAM_MIN_READ = 4096
+  };
+
 protected:
+  typedef std::function<void(const std::error_code &, size_t)>
+      read_handler_t;
+
+  // edge triggered mode, see set_edge_triggered()
+  void start_edge_read(void *read_buf, size_t buf_len, size_t min_bytes,
+                       read_handler_t &&handler);
+  void handle_edge_read();
+  void drain_read();
+  void drain_write();
+  // streaming mode, see start_reading()
+  void start_streaming();
+  void drain_stream();
+  void reset_streaming();
+
+  typedef void (TcpConnection::*step_t)();
+  // run step on the looper later, skipped once the connection is gone
+  void post_step(step_t step);
+
+  void on_read_progress() {
+    if (deadline_entry_.attached()) {
+      deadline_entry_.refresh(Deadlines::IDLE);
+      deadline_entry_.refresh(Deadlines::READ);
+    }
+  }
+  void on_write_progress();
+
   std::unique_ptr<Dispatcher> dispatcher_;
   WriteBuffer write_buffer_;
   size_t bytes_has_read_;
   light::network::INetEndPoint peer_point_;
+
+  bool edge_triggered_;
+  // the last edge has not been drained to EAGAIN yet
+  bool read_ready_;
+  // drain_read() or drain_stream() is on the stack, a read started now is
+  // picked up by it
+  bool draining_;
+  void *read_buf_;
+  size_t read_len_;
+  size_t read_min_;
+  read_handler_t read_handler_;
+
+  bool streaming_;
+  stream_handler_t stream_handler_;
+  ReadBuffer stream_buf_;
+  // chunk streaming mode, chunk_ is the one the next read goes into
+  size_t chunk_len_;
+  chunk_alloc_t chunk_alloc_;
+  chunk_release_t chunk_release_;
+  chunk_handler_t chunk_handler_;
+  char *chunk_;
+  // set by the destructor, a handler may delete the connection
+  bool *destroyed_;
+
+  // posted steps hold the guard instead of the connection, the destructor
+  // clears conn. lock keeps the steps, the edge callbacks and the calls
+  // starting edge triggered I/O off each other when several threads run
+  // the looper, a handler may call back into the connection.
+  struct IoGuard {
+    explicit IoGuard(TcpConnection *c) : lock(), conn(c) {}
+    std::recursive_mutex lock;
+    TcpConnection *conn;
+  };
+  std::shared_ptr<IoGuard> io_guard_;
+
+  Deadlines::Entry deadline_entry_;
 };
 template <typename T> void TcpConnection::set_error_callback(T &&t) {
   dispatcher_->set_error_callback(std::forward<T>(t));
@@ -54,10 +196,21 @@ template <typename T> void TcpConnection::set_error_callback(T &&t) {
 template <typename T> void TcpConnection::set_close_callback(T &&t) {
   dispatcher_->set_close_callback(std::forward<T>(t));
 }
+template <typename T> void TcpConnection::set_half_close_callback(T &&t) {
+  dispatcher_->set_half_close_callback(std::forward<T>(t));
+}
 
 template <typename ReadCallback>
 void TcpConnection::async_read(void *read_buf, size_t bytes_to_read,
                                ReadCallback cb) {
+  if (edge_triggered_) {
+    start_edge_read(read_buf, bytes_to_read, bytes_to_read,
+                    [cb](const std::error_code &ec, size_t) {
+                      if (!ec)
+                        cb();
+                    });
+    return;
+  }
   bytes_has_read_ = 0;
   dispatcher_->enable_read();
   dispatcher_->set_read_callback([this, bytes_to_read, read_buf, cb] {
@@ -77,6 +230,7 @@ void TcpConnection::async_read(void *read_buf, size_t bytes_to_read,
       dispatcher_->disable_read();
     } else {
       bytes_has_read_ += read_bytes;
+      on_read_progress();
       if (bytes_has_read_ == bytes_to_read) {
         dispatcher_->disable_read();
         bytes_has_read_ = 0;
@@ -89,6 +243,10 @@ void TcpConnection::async_read(void *read_buf, size_t bytes_to_read,
 template <typename ReadCallback>
 void TcpConnection::async_read_some(void *read_buf, size_t buf_len,
                                     ReadCallback cb) {
+  if (edge_triggered_) {
+    start_edge_read(read_buf, buf_len, 1, read_handler_t(cb));
+    return;
+  }
   dispatcher_->enable_read();
 
   dispatcher_->set_read_callback([this, read_buf, buf_len, cb] {
@@ -100,6 +258,7 @@ void TcpConnection::async_read_some(void *read_buf, size_t buf_len,
     } else if (read_bytes == 0) {
       cb(LS_MISC_ERR_OBJ(eof), 0);
     } else {
+      on_read_progress();
       cb(LS_OK_ERROR(), read_bytes);
     }
   });
@@ -1,123 +1,301 @@
+#include <algorithm>
+#include <limits>
 #include "network/timer.h"
 namespace light {
 namespace network {
-Timer::Timer(Timestamp tv, functor expire_callback)
-    : next_(tv), interval_(0), expire_callback_(expire_callback),
-      triggered_(false) {}
 
-Timer::Timer(Timestamp tv, Timestamp interval, functor expire_callback)
-    : next_(tv), interval_(interval), expire_callback_(expire_callback),
-      triggered_(false) {}
-
-bool Timer::expired(const Timestamp *now) const {
-  Timestamp val;
-  if (now) {
-    val = *now;
-  } else {
-    val = light::utils::get_timestamp();
+TimerQueue::TimerQueue()
+    : root_count_(0),
+      current_tick_(light::utils::get_monotonic_timestamp() / TICK_US),
+      armed_(0), count_(0), slot_count_(0), free_head_(0) {
+  for (auto &chunk : chunks_) {
+    chunk.store(nullptr, std::memory_order_relaxed);
   }
-  return next_ < val;
 }
 
-bool Timer::forward() {
-  if (!expired())
-    return false;
-  if (triggered_)
-    return false;
-  triggered_ = true;
+TimerQueue::~TimerQueue() {
+  for (auto &chunk : chunks_) {
+    delete[] chunk.load(std::memory_order_relaxed);
+  }
+}
 
-  if (expire_callback_) {
-    expire_callback_();
+TimerId TimerQueue::reserve_id() {
+  uint64_t head = free_head_.load(std::memory_order_acquire);
+  while (head & 0xffffffffULL) {
+    uint32_t idx = static_cast<uint32_t>(head) - 1;
+    // may be stale if another thread takes the slot first, the tag of the
+    // head has changed then and the exchange fails
+    uint64_t next = slot_timer(idx).free_next.load(std::memory_order_relaxed);
+    uint64_t top = (((head >> 32) + 1) << 32) | next;
+    if (free_head_.compare_exchange_weak(head, top, std::memory_order_acq_rel,
+                                         std::memory_order_acquire)) {
+      return (static_cast<TimerId>(slot_timer(idx).generation) << 32) | idx;
+    }
   }
 
-  if (repeatable()) {
-    triggered_ = false;
-    next_ += interval_;
+  uint32_t idx = slot_count_.load(std::memory_order_relaxed);
+  do {
+    if (idx >= MAX_CHUNKS * CHUNK_SIZE)
+      return 0;
+  } while (!slot_count_.compare_exchange_weak(idx, idx + 1,
+                                              std::memory_order_relaxed));
+  std::atomic<Timer *> &chunk = chunks_[idx >> CHUNK_BITS];
+  if (!chunk.load(std::memory_order_acquire)) {
+    Timer *fresh = new Timer[CHUNK_SIZE];
+    Timer *expected = nullptr;
+    if (!chunk.compare_exchange_strong(expected, fresh,
+                                       std::memory_order_acq_rel))
+      delete[] fresh;
   }
-  return true;
+  return (static_cast<TimerId>(slot_timer(idx).generation) << 32) | idx;
 }
 
-// TimerQueue
 TimerId TimerQueue::add_timer(Timestamp expire_time, Timestamp interval,
-                              bool &need_update, functor expire_callback) {
-  auto now = light::utils::get_timestamp();
-  auto timer =
-      std::make_shared<Timer>(expire_time + now, interval, expire_callback);
-  timer->set_timer_id(++last_insert_timer_id_);
-  need_update = insert(timer);
-  return timer->get_timer_id();
+                              bool &need_update, functor expire_callback,
+                              Timestamp slack) {
+  return add_timer_at(light::utils::get_monotonic_timestamp() + expire_time,
+                      interval, need_update, std::move(expire_callback),
+                      slack);
+}
+
+TimerId TimerQueue::add_timer_at(Timestamp when, Timestamp interval,
+                                 bool &need_update, functor expire_callback,
+                                 Timestamp slack) {
+  TimerId timer_id = reserve_id();
+  need_update = false;
+  if (timer_id)
+    add_reserved(timer_id, when, interval, need_update,
+                 std::move(expire_callback), slack);
+  return timer_id;
+}
+
+void TimerQueue::add_reserved(TimerId timer_id, Timestamp when,
+                              Timestamp interval, bool &need_update,
+                              functor expire_callback, Timestamp slack) {
+  Timer *timer = &slot_timer(static_cast<uint32_t>(timer_id));
+  timer->expire = when;
+  timer->interval = interval;
+  timer->slack = slack;
+  timer->tick = slack_tick(when, slack);
+  timer->callback = std::move(expire_callback);
+  timer->timer_id = timer_id;
+  timer->active = true;
+  ++count_;
+  schedule(*timer);
+  need_update = !armed_ || timer->tick * TICK_US < armed_;
 }
 
 void TimerQueue::del_timer(TimerId timer_id, bool &need_update) {
   need_update = false;
-  auto itr = timer_id_map_.find(timer_id);
-  if (itr == timer_id_map_.end()) {
+  Timer *timer = find_timer(timer_id);
+  if (!timer)
+    return;
+  timer->active = false;
+  --count_;
+  if (timer->running) {
+    // fire() lets it go once the callback returns
+    timer->cancelled = true;
     return;
   }
-  auto timer = itr->second->second;
-  TimerEntry ent(timer->get_next(), timer);
-  auto it = queue_.find(ent);
-  if (it != queue_.end()) {
-    if (it == queue_.begin())
-      need_update = true;
-    queue_.erase(it);
-    timer_id_map_.erase(timer_id);
-  }
+  unschedule(*timer);
+  release_timer(timer);
 }
 
 void TimerQueue::print_queue() {
-  LOG(DEBUG) << "QUEUE " << queue_.size();
-  for (auto &kv : queue_) {
-    LOG(DEBUG) << "next: " << kv.first << "  timer: " << kv.second;
+  LOG(DEBUG) << "QUEUE " << count_ << " root " << root_count_ << " tick "
+             << current_tick_;
+  uint32_t slots = slot_count_.load(std::memory_order_relaxed);
+  for (uint32_t idx = 0; idx < slots; ++idx) {
+    if (!chunks_[idx >> CHUNK_BITS].load(std::memory_order_acquire))
+      continue;
+    Timer &timer = slot_timer(idx);
+    if (timer.active)
+      LOG(DEBUG) << "next: " << timer.expire << "  timer: " << timer.timer_id;
   }
 }
 
 void TimerQueue::update_time(Timestamp now) {
-  for (auto it = queue_.begin(); it != queue_.end();) {
-    auto timer = it->second;
-    if (timer->expired(&now)) {
-      timer->forward();
-      if (queue_.begin() == queue_.end() || queue_.begin()->second != timer) {
-        // this iterator is invalid, (may cancelled )reset to begin
-        it = queue_.begin();
+  uint64_t target = now / TICK_US;
+  while (current_tick_ <= target) {
+    if (!root_count_) {
+      // nothing fires before the next cascade
+      uint64_t next = !count_ ? target + 1 : next_tick();
+      if (next > current_tick_) {
+        current_tick_ = (std::min)(next, target + 1);
         continue;
       }
-      it = queue_.erase(it);
-      if (timer->repeatable()) {
-        insert(timer);
-        it = queue_.begin();
-      } else {
-        timer_id_map_.erase(timer->get_timer_id());
-      }
-    } else {
-      break;
     }
+    run_tick();
   }
 }
 
 void TimerQueue::update_time_now() {
-  update_time(light::utils::get_timestamp());
+  update_time(light::utils::get_monotonic_timestamp());
+}
+
+Timestamp TimerQueue::next_expiry() {
+  armed_ = !count_ ? 0 : next_tick() * TICK_US;
+  return armed_;
+}
+
+uint64_t TimerQueue::slack_tick(Timestamp expire, Timestamp slack) {
+  uint64_t first = (expire + TICK_US - 1) / TICK_US;
+  uint64_t last = (expire + slack) / TICK_US;
+  if (last <= first)
+    return first;
+  // keep the bits both ends share and the highest one they differ in,
+  // that tick is inside the window and as round as the window allows
+  uint64_t mask = first ^ last;
+  int bit = 63;
+  while (!(mask >> bit))
+    --bit;
+  return last & ~((1ULL << bit) - 1);
+}
+
+void TimerQueue::schedule(Timer &timer) {
+  // late, or re-armed while its own tick runs
+  uint64_t tick = (std::max)(timer.tick, current_tick_);
+  uint64_t delta = tick - current_tick_;
+  if (delta < ROOT_SIZE) {
+    timer.level = 0;
+    ++root_count_;
+    root_[tick & (ROOT_SIZE - 1)].push_back(timer);
+    return;
+  }
+  int level = 1;
+  while (level < LEVELS &&
+         delta >= (1ULL << (level_shift(level) + LEVEL_BITS))) {
+    ++level;
+  }
+  if (level == LEVELS) {
+    // beyond the top level, parked in its furthest slot
+    uint64_t reach = 1ULL << (level_shift(LEVELS) + LEVEL_BITS);
+    if (delta >= reach)
+      tick = current_tick_ + reach - 1;
+  }
+  timer.level = level;
+  slot(level, (tick >> level_shift(level)) & (LEVEL_SIZE - 1))
+      .push_back(timer);
+}
+
+void TimerQueue::unschedule(Timer &timer) {
+  if (timer.level == 0)
+    --root_count_;
+  timer.level = -1;
+  timer.unlink();
 }
 
-std::shared_ptr<Timer> TimerQueue::get_nearist_timer() {
-  if (queue_.size()) {
-    return queue_.begin()->second;
+void TimerQueue::cascade(int level, size_t idx) {
+  Link pending;
+  pending.splice(slot(level, idx));
+  while (!pending.empty()) {
+    Timer *timer = static_cast<Timer *>(pending.next);
+    timer->unlink();
+    schedule(*timer);
   }
-  return nullptr;
 }
 
-bool TimerQueue::insert(std::shared_ptr<Timer> timer) {
-  bool need_update = false;
-  auto next = timer->get_next();
-  auto it = queue_.begin();
-  if (it == queue_.end() || next < it->first) {
-    need_update = true;
+void TimerQueue::run_tick() {
+  uint64_t tick = current_tick_;
+  size_t idx = tick & (ROOT_SIZE - 1);
+  // the root wrapped, bring down the next slot of each level that did
+  for (int level = 1; !idx && level <= LEVELS; ++level) {
+    idx = (tick >> level_shift(level)) & (LEVEL_SIZE - 1);
+    cascade(level, idx);
   }
 
-  auto itr = queue_.insert(TimerEntry(timer->get_next(), timer)).first;
-  timer_id_map_[timer->get_timer_id()] = itr;
-  return need_update;
+  Link expired;
+  expired.splice(root_[tick & (ROOT_SIZE - 1)]);
+  for (Link *node = expired.next; node != &expired; node = node->next) {
+    static_cast<Timer *>(node)->level = -1;
+    --root_count_;
+  }
+  // timers armed by the callbacks go to the next tick at the earliest
+  ++current_tick_;
+  while (!expired.empty()) {
+    Timer *timer = static_cast<Timer *>(expired.next);
+    timer->unlink();
+    fire(*timer);
+  }
 }
-} /* ne */
 
+void TimerQueue::fire(Timer &timer) {
+  timer.running = true;
+  if (timer.callback)
+    timer.callback();
+  timer.running = false;
+  if (timer.cancelled || !timer.interval) {
+    if (!timer.cancelled) {
+      timer.active = false;
+      --count_;
+    }
+    release_timer(&timer);
+    return;
+  }
+  timer.expire += timer.interval;
+  timer.tick = slack_tick(timer.expire, timer.slack);
+  schedule(timer);
+}
+
+uint64_t TimerQueue::next_tick() const {
+  uint64_t best = (std::numeric_limits<uint64_t>::max)();
+  if (root_count_) {
+    for (uint64_t d = 0; d < ROOT_SIZE; ++d) {
+      if (!root_[(current_tick_ + d) & (ROOT_SIZE - 1)].empty()) {
+        best = current_tick_ + d;
+        break;
+      }
+    }
+  }
+  for (int level = 1; level <= LEVELS; ++level) {
+    int shift = level_shift(level);
+    uint64_t base = current_tick_ >> shift;
+    // the current slot cascades now if the lower wheels are at 0, else
+    // after a whole turn
+    bool aligned = !(current_tick_ & ((1ULL << shift) - 1));
+    for (uint64_t d = aligned ? 0 : 1; d <= LEVEL_SIZE; ++d) {
+      uint64_t tick = (base + d) << shift;
+      if (tick >= best)
+        break;
+      if (!levels_[level - 1][(base + d) & (LEVEL_SIZE - 1)].empty()) {
+        best = tick;
+        break;
+      }
+    }
+  }
+  return best;
+}
+
+TimerQueue::Timer *TimerQueue::find_timer(TimerId timer_id) const {
+  uint32_t idx = static_cast<uint32_t>(timer_id);
+  if (idx >= slot_count_.load(std::memory_order_relaxed) ||
+      !chunks_[idx >> CHUNK_BITS].load(std::memory_order_acquire))
+    return nullptr;
+  Timer &timer = slot_timer(idx);
+  if (!timer.active || timer.timer_id != timer_id)
+    return nullptr;
+  return &timer;
+}
+
+void TimerQueue::release_timer(Timer *timer) {
+  // drop whatever the callback holds now
+  timer->callback = nullptr;
+  timer->level = -1;
+  timer->cancelled = false;
+  timer->active = false;
+  // ids of the old generation stop matching
+  if (!++timer->generation)
+    timer->generation = 1;
+  uint32_t idx = static_cast<uint32_t>(timer->timer_id);
+  uint64_t head = free_head_.load(std::memory_order_relaxed);
+  uint64_t top;
+  do {
+    timer->free_next.store(static_cast<uint32_t>(head),
+                           std::memory_order_relaxed);
+    top = (((head >> 32) + 1) << 32) | (idx + 1);
+  } while (!free_head_.compare_exchange_weak(head, top,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+}
+} /* network */
 } /* light */
@@ -1,80 +1,224 @@
 #pragma once
-#include <algorithm>
-#include <set>
-#include <time.h>
-#include <tuple>
+#include <atomic>
+#include <functional>
+#include <stdint.h>
 #include "utils/helpers.h"
 #include "utils/logger.h"
-#include <unordered_map>
+#include "utils/noncopyable.h"
 
 namespace light {
 namespace network {
 
 typedef uint64_t Timestamp;
-typedef uint32_t TimerId;
+// slot index in the low 32 bits, generation of the slot in the high ones
+typedef uint64_t TimerId;
 typedef std::function<void(void)> functor;
 
-class Timer : public std::enable_shared_from_this<Timer> {
-public:
-  explicit Timer(Timestamp &tv) { Timer(tv, functor()); }
-
-  Timer(Timestamp tv, functor expire_callback);
-
-  Timer(Timestamp tv, Timestamp interval, functor expire_callback);
-
-  bool expired(const Timestamp *now = nullptr) const;
-
-  bool forward();
-
-  inline bool repeatable() const { return interval_ != 0; }
-
-  inline bool triggered() const { return triggered_; }
-
-  Timestamp &get_next() { return this->next_; }
-
-  bool operator<(const Timer &rhs) const {
-    return (next_ < rhs.next_) || (next_ == rhs.next_ && this < &rhs);
-  }
-
-  void set_timer_id(TimerId timer_id) { timer_id_ = timer_id; }
-
-  TimerId get_timer_id() const { return timer_id_; }
-
-private:
-  Timestamp next_;
-  Timestamp interval_;
-  functor expire_callback_;
-  bool triggered_;
-  TimerId timer_id_;
-};
-
+/**
+ * @brief hierarchical timing wheel. Times are microseconds, timers expire
+ * on TICK_US boundaries and never before their time.
+ *
+ * The root wheel holds the next ROOT_SIZE ticks, one slot per tick, every
+ * upper level holds LEVEL_SIZE slots each as long as a whole turn of the
+ * level below. A timer goes straight to the slot of its tick's distance,
+ * when the lower wheels wrap the next slot of the level above is cascaded
+ * down. Adding and cancelling are O(1), a tick fires its whole slot at
+ * once. Timers further out than the wheels reach wait in the last slot of
+ * the top level and are placed again when it cascades.
+ *
+ * Timer nodes live in slots that are never freed, a steady timer load
+ * allocates nothing. A TimerId names a slot and its generation, which
+ * changes whenever the slot is released: looking a timer up is an index,
+ * and an id whose timer fired or was cancelled never matches a later timer
+ * of the same slot.
+ *
+ * Only reserve_id() is thread safe, everything else belongs to one thread
+ * at a time.
+ */
 class TimerQueue : public light::utils::NonCopyable {
 public:
-  TimerQueue() : queue_() {}
-
+  enum { TICK_US = 1000 };
+
+  TimerQueue();
+
+  ~TimerQueue();
+
+  /**
+   * @brief any thread, lock free: the id of a timer that add_reserved()
+   * adds later. 0 when every slot is taken.
+   */
+  TimerId reserve_id();
+
+  /**
+   * @brief add_timer_at() for a reserved id
+   */
+  void add_reserved(TimerId timer_id, Timestamp when, Timestamp interval,
+                    bool &need_update, functor expire_callback,
+                    Timestamp slack = 0);
+
+  /**
+   * @param expire_time from now on
+   *
+   * @param need_update set if the timer is due before the time
+   * next_expiry() returned last
+   *
+   * @param slack how late the timer may fire. The timer goes to the tick of
+   * its window with the most trailing zero bits, timers whose windows
+   * overlap share that tick and one wakeup.
+   */
   TimerId add_timer(Timestamp expire_time, Timestamp interval,
-                    bool &need_update, functor expire_callback);
-
+                    bool &need_update, functor expire_callback,
+                    Timestamp slack = 0);
+
+  /**
+   * @param when absolute, see light::utils::get_monotonic_timestamp()
+   *
+   * @return 0 when every slot is taken
+   */
+  TimerId add_timer_at(Timestamp when, Timestamp interval, bool &need_update,
+                       functor expire_callback, Timestamp slack = 0);
+
+  /**
+   * @brief a timer may cancel itself from its own callback. An id that is
+   * gone already is ignored. need_update is never set, waking up for
+   * nothing is cheaper than asking the wheels
+   */
   void del_timer(TimerId timer_id, bool &need_update);
 
   void print_queue();
 
+  /**
+   * @brief fire the timers due at now
+   */
   void update_time(Timestamp now);
 
   void update_time_now();
 
-  std::shared_ptr<Timer> get_nearist_timer();
+  /**
+   * @brief when update_time() has work next: the earliest timer, or a
+   * cascade of an upper level before it. 0 without timers.
+   */
+  Timestamp next_expiry();
 
-  bool insert(std::shared_ptr<Timer> timer);
+  size_t size() const { return count_; }
 
 private:
-  typedef std::pair<Timestamp, std::shared_ptr<Timer>> TimerEntry;
+  enum {
+    ROOT_BITS = 8,
+    ROOT_SIZE = 1 << ROOT_BITS,
+    LEVEL_BITS = 6,
+    LEVEL_SIZE = 1 << LEVEL_BITS,
+    // levels above the root, together they reach 2^32 ticks
+    LEVELS = 4,
+    // slots are allocated a chunk at a time, up to MAX_CHUNKS chunks
+    CHUNK_BITS = 10,
+    CHUNK_SIZE = 1 << CHUNK_BITS,
+    MAX_CHUNKS = 4096
+  };
+
+  struct Link {
+    Link() : prev(this), next(this) {}
+
+    bool empty() const { return next == this; }
+
+    void push_back(Link &node) {
+      node.prev = prev;
+      node.next = this;
+      prev->next = &node;
+      prev = &node;
+    }
+
+    void unlink() {
+      prev->next = next;
+      next->prev = prev;
+      prev = next = this;
+    }
+
+    // takes over every node of other
+    void splice(Link &other) {
+      if (other.empty())
+        return;
+      other.next->prev = prev;
+      other.prev->next = this;
+      prev->next = other.next;
+      prev = other.prev;
+      other.prev = other.next = &other;
+    }
+
+    Link *prev;
+    Link *next;
+  };
+
+  struct Timer : Link {
+    Timer()
+        : expire(0), interval(0), slack(0), tick(0), callback(), timer_id(0),
+          level(-1), running(false), cancelled(false), active(false),
+          generation(1), free_next(0) {}
+
+    Timestamp expire;
+    Timestamp interval;
+    Timestamp slack;
+    // the tick it fires at, within [expire, expire + slack]
+    uint64_t tick;
+    functor callback;
+    TimerId timer_id;
+    // wheel the timer is linked in, 0 is the root, -1 none
+    int level;
+    bool running;
+    bool cancelled;
+    // added and neither fired for the last time nor cancelled
+    bool active;
+    // of the id the slot hands out next, never 0
+    uint32_t generation;
+    // index + 1 of the next free slot, 0 ends the list
+    std::atomic<uint32_t> free_next;
+  };
+
+  // the tick in the window of a timer with the most trailing zero bits
+  static uint64_t slack_tick(Timestamp expire, Timestamp slack);
+
+  static int level_shift(int level) {
+    return ROOT_BITS + (level - 1) * LEVEL_BITS;
+  }
 
-  std::unordered_map<TimerId, std::set<TimerEntry>::const_iterator>
-      timer_id_map_;
-  std::set<TimerEntry> queue_;
+  Link &slot(int level, size_t idx) {
+    return level ? levels_[level - 1][idx] : root_[idx];
+  }
 
-  TimerId last_insert_timer_id_ = 0;
+  void schedule(Timer &timer);
+  void unschedule(Timer &timer);
+  void cascade(int level, size_t idx);
+  void run_tick();
+  void fire(Timer &timer);
+  // the first tick from current_tick_ on with a timer or a cascade
+  uint64_t next_tick() const;
+
+  Timer &slot_timer(uint32_t idx) const {
+    return chunks_[idx >> CHUNK_BITS].load(std::memory_order_acquire)
+        [idx & (CHUNK_SIZE - 1)];
+  }
+  // the timer of a live id, nullptr if it is gone
+  Timer *find_timer(TimerId timer_id) const;
+  void release_timer(Timer *timer);
+
+  Link root_[ROOT_SIZE];
+  Link levels_[LEVELS][LEVEL_SIZE];
+  // timers linked in root_, without any the idle ticks are skipped
+  size_t root_count_;
+  // the next tick update_time() processes
+  uint64_t current_tick_;
+  // what next_expiry() returned last
+  Timestamp armed_;
+
+  // active timers
+  size_t count_;
+
+  std::atomic<Timer *> chunks_[MAX_CHUNKS];
+  // slots handed out so far, the ones below are in a chunk
+  std::atomic<uint32_t> slot_count_;
+  // lock free stack of released slots: a tag bumped by every change in the
+  // high 32 bits against ABA, index + 1 of the top in the low ones
+  std::atomic<uint64_t> free_head_;
 };
 } /* network */
 } /* light */
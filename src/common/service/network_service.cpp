@@ -1,5 +1,7 @@
+#include <string.h>
 #include "enet/enet.h"
 #include "network/acceptor.h"
+#include "network/dispatcher.h"
 #include "network/endpoint.h"
 #include "network/tcp_connection.h"
 #include "network/tcp_client.h"
@@ -23,6 +25,26 @@ ENetAddressToEndPoint(const ENetAddress &addr) {
   return v4;
 }
 
+// when enet_host_service() has work without a datagram coming in: the
+// earliest resend, or a ping to a peer nothing was heard from for a while.
+// false while no peer is connected.
+static bool next_enet_timeout(const ENetHost &host, enet_uint32 &timeout) {
+  bool pending = false;
+  for (size_t i = 0; i < host.peerCount; ++i) {
+    const ENetPeer &peer = host.peers[i];
+    if (peer.state == ENET_PEER_STATE_DISCONNECTED ||
+        peer.state == ENET_PEER_STATE_ZOMBIE)
+      continue;
+    enet_uint32 next = enet_list_empty(&peer.sentReliableCommands)
+                           ? peer.lastReceiveTime + peer.pingInterval
+                           : peer.nextTimeout;
+    if (!pending || ENET_TIME_LESS(next, timeout))
+      timeout = next;
+    pending = true;
+  }
+  return pending;
+}
+
 static light::network::INetEndPoint
 get_tcp_peer_endpoint(light::network::TcpConnection *conn) {
   light::network::INetEndPoint point;
@@ -33,15 +55,25 @@ get_tcp_peer_endpoint(light::network::TcpConnection *conn) {
   return point;
 }
 
-NetworkService::NetworkService(light::core::Context &ctx, int thread_count)
-    : NetworkService(thread_count ? new light::network::Looper : &ctx.get_looper(), ctx.get_mq(), thread_count) {}
+NetworkService::NetworkService(light::core::Context &ctx, int thread_count,
+                               int io_looper_count,
+                               light::network::LooperGroup::BalancePolicy policy,
+                               light::network::SchedulerType scheduler_type)
+    : NetworkService(thread_count ? new light::network::Looper(scheduler_type) : &ctx.get_looper(), ctx.get_mq(), thread_count,
+                     io_looper_count, policy, scheduler_type) {}
 
 NetworkService::NetworkService(light::network::Looper *looper,
-  light::core::MessageQueue &mq, int thread_count) : Service(*looper, mq), last_socket_id_(0), last_callback_idx_(0),
-  loop_idx_(0), thread_count_(thread_count) {
+  light::core::MessageQueue &mq, int thread_count, int io_looper_count,
+  light::network::LooperGroup::BalancePolicy policy,
+  light::network::SchedulerType scheduler_type) : Service(*looper, mq), tcp_timeouts_(), last_socket_id_(0), last_callback_idx_(0),
+  loop_idx_(0), enet_timer_(0), enet_timeout_(0), thread_count_(thread_count) {
   if (thread_count) {
     internal_looper_.reset(looper);
   }
+  if (io_looper_count) {
+    io_group_.reset(new light::network::LooperGroup(io_looper_count, policy,
+                                                    scheduler_type));
+  }
 }
 
 NetworkService::~NetworkService() {
@@ -56,20 +88,58 @@ std::error_code NetworkService::init() {
   }
   loop_idx_ = get_looper().register_loop_callback(
       std::bind(&NetworkService::on_loop, this));
+  bool tcp_deadlines = false;
+  for (auto timeout : tcp_timeouts_) {
+    tcp_deadlines = tcp_deadlines || timeout;
+  }
+  if (tcp_deadlines) {
+    // created before the loopers run, only looked up from their threads
+    if (io_group_) {
+      for (size_t i = 0; i < io_group_->size(); ++i) {
+        tcp_deadlines_.emplace_back(
+            new light::network::Deadlines(io_group_->get_looper(i)));
+      }
+    } else {
+      tcp_deadlines_.emplace_back(
+          new light::network::Deadlines(get_looper()));
+    }
+    for (auto &deadlines : tcp_deadlines_) {
+      for (int type = 0; type < light::network::Deadlines::TYPE_COUNT;
+           ++type) {
+        deadlines->set_timeout(
+            static_cast<light::network::Deadlines::Type>(type),
+            tcp_timeouts_[type]);
+      }
+    }
+  }
   for (int i = 0; i < thread_count_; ++i) {
-    threads_.emplace_back([this]() {
+    threads_.emplace_back([this, i]() {
+      auto ec = placement_.apply(i);
+      if (ec) {
+        LOG(WARNING) << "failed to place network thread " << i << ": "
+                     << ec.message();
+      }
       get_looper().loop();
     });
   }
+  if (io_group_) {
+    io_group_->set_placement(placement_, thread_count_);
+    io_group_->start();
+  }
   return LS_OK_ERROR();
 }
 
 void NetworkService::on_loop() {
+  bool pending = false;
+  enet_uint32 timeout = 0;
   for (auto &kv : enet_host_map_) {
     ENetEvent event;
 
     enet_host_flush(kv.second.ptr.get());
-    if (enet_host_service(kv.second.ptr.get(), &event, 0) > 0) {
+    // the socket is level triggered, but queued events are not seen by
+    // the poller: take them all unless the budget runs out
+    int budget = ENET_EVENT_BUDGET;
+    while (enet_host_service(kv.second.ptr.get(), &event, 0) > 0) {
       switch (event.type) {
       case ENET_EVENT_TYPE_CONNECT:
 				DLOG(INFO) << "conn host service";
@@ -84,8 +154,56 @@ void NetworkService::on_loop() {
       default:
         break;
       }
+      if (!--budget) {
+        get_looper().request_next_iteration();
+        break;
+      }
+    }
+    enet_uint32 host_timeout;
+    if (next_enet_timeout(*kv.second.ptr, host_timeout) &&
+        (!pending || ENET_TIME_LESS(host_timeout, timeout))) {
+      timeout = host_timeout;
+      pending = true;
     }
   }
+  arm_enet_timer(pending, timeout);
+}
+
+std::shared_ptr<ENetHost> NetworkService::watch_enet_host(ENetHost *host) {
+  // a datagram wakes the poller, on_loop() reads it in the check phase
+  std::shared_ptr<light::network::Dispatcher> dispatcher(
+      new light::network::Dispatcher(get_looper(), host->socket));
+  dispatcher->set_read_callback([] {});
+  dispatcher->enable_read();
+  return std::shared_ptr<ENetHost>(host, [dispatcher](ENetHost *h) {
+    dispatcher->detach();
+    enet_host_destroy(h);
+  });
+}
+
+void NetworkService::arm_enet_timer(bool pending, enet_uint32 timeout) {
+  enet_uint32 now = enet_time_get();
+  // a timer that fired is gone, cancelling it does nothing
+  if (enet_timer_ && pending && timeout == enet_timeout_ &&
+      ENET_TIME_LESS(now, enet_timeout_))
+    return;
+  std::error_code ec;
+  if (enet_timer_) {
+    get_looper().cancel_timer(ec, enet_timer_);
+    enet_timer_ = 0;
+  }
+  if (!pending)
+    return;
+  // enet counts milliseconds, one more makes sure the time has come
+  enet_uint32 delay =
+      ENET_TIME_LESS(now, timeout) ? ENET_TIME_DIFFERENCE(timeout, now) : 0;
+  enet_timer_ = get_looper().add_timer(
+      ec, light::network::Timestamp(delay + 1) * 1000, 0, [] {});
+  if (ec) {
+    LOG(WARNING) << "failed to arm the enet timer: " << ec.message();
+    return;
+  }
+  enet_timeout_ = timeout;
 }
 
 void NetworkService::forward_message(const NetworkServiceMessage &msg,
@@ -229,12 +347,20 @@ std::error_code NetworkService::fini() {
     get_looper().unregister_loop_callback(loop_idx_);
     loop_idx_ = 0;
   }
+  if (enet_timer_) {
+    std::error_code ec;
+    get_looper().cancel_timer(ec, enet_timer_);
+    enet_timer_ = 0;
+  }
   if (thread_count_) {
     get_looper().stop();
     for(auto &thd : threads_) {
       thd.join();
     }
   }
+  if (io_group_) {
+    io_group_->stop();
+  }
   return LS_OK_ERROR();
 }
 
@@ -294,14 +420,12 @@ void NetworkService::create_udp_server(
   server = enet_host_create(&address, max_peer, max_channel, 0, 0);
   if (server == nullptr) {
     func(LS_MISC_ERR_OBJ(unknown), 0);
+    return;
   }
 
   uint32_t key = ++last_socket_id_;
   key |= (CONN_TYPE_UDP_SERVER << CONN_TYPE_SHIFT);
-  std::shared_ptr<ENetHost> enet_host(server, [this](ENetHost* h)
-  {
-	  enet_host_destroy(h);
-  });
+  auto enet_host = watch_enet_host(server);
   enet_host_map_[key] = ConnectionContainer<ENetHost>(enet_host, opaque);
   DLOG(INFO) << "create_udp_server " << key;
   func(LS_OK_ERROR(), key);
@@ -314,34 +438,68 @@ void NetworkService::on_get_message_from_remote(
                        opaque, handle, pkt, endpoint);
 }
 
-void NetworkService::async_read_tcp_connection(
-    light::network::TcpConnection *conn, uint32_t handle) {
-  // use fixed allocator
-	std::shared_ptr<char> buf_ptr(fixed_alloc_.alloc(), [this](char *buf){
-				fixed_alloc_.dealloc(buf);
-		}); // 2M
-
-  conn->async_read_some(
-      buf_ptr.get(), fixed_alloc_.node_size(),
-      [this, conn, handle, buf_ptr](std::error_code ec, size_t bytes_read) {
-				char *buf = buf_ptr.get();
-        if (!ec) {
-          CommonPacket pkt;
-          pkt.data = buf;
-          pkt.size = bytes_read;
-          pkt.handle = handle;
-		  auto opaque = tcp_connection_map_[handle].opaque;
-          this->on_get_message_from_remote(handle, pkt,
-                                           get_tcp_peer_endpoint(conn), opaque);
-          this->async_read_tcp_connection(conn, handle);
-        } else {
-          handle_tcp_error(handle, ec);
+void NetworkService::start_reading_tcp_connection(
+    light::network::TcpConnection *conn, uint32_t handle, uint32_t opaque) {
+  // raw bytes, framing is up to the station: every read lands straight in a
+  // fixed allocator node that goes out as the packet
+  conn->start_reading(
+      fixed_alloc_.node_size(), [] { return fixed_alloc_.alloc(); },
+      [](char *buf) { fixed_alloc_.dealloc(buf); },
+      [this, conn, handle, opaque](const std::error_code &ec, char *buf,
+                                   size_t size) {
+        if (ec) {
+          on_tcp_error(handle, ec);
+          return;
         }
+        CommonPacket pkt;
+        pkt.data = buf;
+        pkt.size = size;
+        pkt.handle = handle;
+        pkt.destroy = [buf] { fixed_alloc_.dealloc(buf); };
+        this->on_get_message_from_remote(handle, pkt,
+                                         get_tcp_peer_endpoint(conn), opaque);
       });
 }
 
+void NetworkService::on_tcp_error(uint32_t handle, const std::error_code &ec) {
+  if (io_group_) {
+    // called from an io looper, connection maps belong to the service
+    // strand. Never shed: a lost teardown would keep the connection forever.
+    post_unbounded<NetworkService>(&NetworkService::handle_tcp_error, handle,
+                                   ec);
+  } else {
+    handle_tcp_error(handle, ec);
+  }
+}
+
+void NetworkService::on_tcp_close(uint32_t handle) {
+  if (io_group_) {
+    post_unbounded<NetworkService>(&NetworkService::handle_tcp_close, handle);
+  } else {
+    handle_tcp_close(handle);
+  }
+}
+
+void NetworkService::on_tcp_timeout(uint32_t handle,
+                                    light::network::Deadlines::Type type) {
+  static const char *names[] = {"idle", "read", "write"};
+  DLOG(INFO) << "tcp " << names[type] << " timeout " << handle;
+  on_tcp_error(handle, LS_GENERIC_ERR_OBJ(timed_out));
+}
+
+light::network::Deadlines *
+NetworkService::get_tcp_deadlines(light::network::Looper &looper) {
+  for (auto &deadlines : tcp_deadlines_) {
+    if (&deadlines->get_looper() == &looper)
+      return deadlines.get();
+  }
+  return nullptr;
+}
+
 void NetworkService::handle_tcp_error(uint32_t handle,
                                       const std::error_code &ec) {
+  if (!check_handle_exists(handle))
+    return;
   auto conn = tcp_connection_map_[handle];
   forward_error_message(NetworkServiceMessageType::NET_MSG_TYPE_EXECPTION,
                         conn.opaque, handle, ec,
@@ -350,6 +508,8 @@ void NetworkService::handle_tcp_error(uint32_t handle,
 }
 
 void NetworkService::handle_tcp_close(uint32_t handle) {
+  if (!check_handle_exists(handle))
+    return;
   auto conn = tcp_connection_map_[handle];
   forward_event_message(NetworkServiceMessageType::NET_MSG_TYPE_CLOSE,
                         conn.opaque, handle,
@@ -361,18 +521,48 @@ std::tuple<uint32_t, light::network::TcpConnection *>
 NetworkService::install_tcp_connection(int sockfd, uint32_t opaque) {
   uint32_t key = ++last_socket_id_;
   key |= (CONN_TYPE_TCP_CLIENT << CONN_TYPE_SHIFT);
-  auto conn = new light::network::TcpConnection(get_looper(), sockfd);
-  tcp_connection_map_[key] = ConnectionContainer<light::network::TcpConnection>(std::shared_ptr<light::network::TcpConnection>(conn, [](light::network::TcpConnection *p)
+  auto &looper = io_group_ ? io_group_->acquire_looper() : get_looper();
+  auto conn = new light::network::TcpConnection(looper, sockfd);
+  auto group = io_group_.get();
+  tcp_connection_map_[key] = ConnectionContainer<light::network::TcpConnection>(std::shared_ptr<light::network::TcpConnection>(conn, [group](light::network::TcpConnection *p)
   {
+    if (group) {
+      auto &io_looper = p->get_looper();
+      group->release_looper(io_looper);
+      if (group->running()) {
+        // dispatcher belongs to the io looper, tear it down there
+        io_looper.post_unbounded([p] {
+          p->close();
+          delete p;
+        });
+        return;
+      }
+    }
 	  p->close();
 	  delete p;
   }), opaque);
-  this->async_read_tcp_connection(conn, key);
-  conn->set_error_callback([conn, this, key]() {
-    auto ec = conn->get_last_error();
-    handle_tcp_error(key, ec);
-  });
-  conn->set_close_callback([conn, this, key]() { handle_tcp_close(key); });
+  // cache the peer address now, the io looper only reads it afterwards
+  get_tcp_peer_endpoint(conn);
+  auto deadlines = get_tcp_deadlines(looper);
+  auto setup = [this, conn, key, opaque, deadlines] {
+    if (deadlines) {
+      conn->set_deadlines(*deadlines,
+                          [this, key](light::network::Deadlines::Type type) {
+                            on_tcp_timeout(key, type);
+                          });
+    }
+    this->start_reading_tcp_connection(conn, key, opaque);
+    conn->set_error_callback([conn, this, key]() {
+      auto ec = conn->get_last_error();
+      on_tcp_error(key, ec);
+    });
+    conn->set_close_callback([this, key]() { on_tcp_close(key); });
+  };
+  if (io_group_) {
+    looper.post_unbounded(setup);
+  } else {
+    setup();
+  }
   return std::make_tuple(key, conn);
 }
 
@@ -412,14 +602,12 @@ void NetworkService::create_udp_stub(int max_peer, int max_channel,
   client = enet_host_create(nullptr, max_peer, max_channel, 0, 0);
   if (client == nullptr) {
     func(LS_MISC_ERR_OBJ(unknown), 0);
+    return;
   }
 
   uint32_t key = ++last_socket_id_;
   key |= (CONN_TYPE_UDP_SERVER << CONN_TYPE_SHIFT);
-  std::shared_ptr<ENetHost> enet_host(client, [](ENetHost *c)
-  {
-	  enet_host_destroy(c);
-  });
+  auto enet_host = watch_enet_host(client);
   enet_host_map_[key] = ConnectionContainer<ENetHost>(enet_host, opaque);
   func(LS_OK_ERROR(), key);
 } /*}}}*/
@@ -459,6 +647,8 @@ void NetworkService::connect_udp_server(
     func(ec, 0);
   } else {
     connect_callbacks_[peer] = std::make_tuple(tid, func, opaque);
+    // the connect command is queued only, on_loop() sends it
+    get_looper().request_next_iteration();
   }
 } /*}}}*/
 
@@ -484,6 +674,8 @@ void NetworkService::internal_close(uint32_t handle,
   case CONN_TYPE_UDP_CLIENT: {
     ENetPeer *peer = std::get<0>(enet_peer_map_[handle]);
     enet_peer_disconnect(peer, 0);
+    // queued only, on_loop() sends it
+    get_looper().request_next_iteration();
     if (active_close) {
       active_close_handlers_.insert(handle);
 	  enet_peer_map_.erase(handle);
@@ -510,9 +702,16 @@ void NetworkService::send_common_packet(CommonPacket packet,
 
   switch (GET_CONN_TYPE(packet.handle)) {
   case CONN_TYPE_TCP_CLIENT: {
-    auto conn = tcp_connection_map_[packet.handle];
-    conn.ptr->async_write(packet.data, packet.size,
-                               [packet] { packet.destroy(); });
+    auto conn = tcp_connection_map_[packet.handle].ptr;
+    if (io_group_) {
+      conn->get_looper().post([conn, packet] {
+        conn->async_write(packet.data, packet.size,
+                          [packet] { packet.destroy(); });
+      });
+    } else {
+      conn->async_write(packet.data, packet.size,
+                        [packet] { packet.destroy(); });
+    }
   } break;
   case CONN_TYPE_UDP_CLIENT: {
     // use packet pool?
@@ -530,6 +729,8 @@ void NetworkService::send_common_packet(CommonPacket packet,
 
     ENetPeer *peer = std::get<0>(enet_peer_map_[packet.handle]);
     enet_peer_send(peer, channel, enet_pkt);
+    // queued only, on_loop() sends it
+    get_looper().request_next_iteration();
 
   } break;
   default:
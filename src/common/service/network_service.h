@@ -1,13 +1,17 @@
 #pragma once
+#include <set>
 #include "enet/enet.h"
 #include "network/acceptor.h"
+#include "network/deadlines.h"
 #include "network/endpoint.h"
+#include "network/looper_group.h"
 #include "network/tcp_connection.h"
 #include "network/tcp_client.h"
 #include "core/message.h"
 #include "core/service.h"
 #include "utils/allocator.h"
 #include "utils/buffer.h"
+#include "utils/thread_placement.h"
 
 namespace light {
 namespace service {
@@ -52,13 +56,51 @@ public:
 
 private:
   NetworkService(light::network::Looper *looper,
-    light::core::MessageQueue &mq, int thread_count);
+    light::core::MessageQueue &mq, int thread_count, int io_looper_count,
+    light::network::LooperGroup::BalancePolicy policy,
+    light::network::SchedulerType scheduler_type);
 
 public:
-  NetworkService(light::core::Context &ctx, int thread_count);
+  /**
+   * @param thread_count threads running the service looper, 0 means sharing
+   * the looper of ctx
+   * @param io_looper_count if not 0, tcp connections are spread over a
+   * LooperGroup of that many loopers, each running its own event loop
+   * @param policy how a connection is assigned to an io looper
+   * @param scheduler_type scheduler of the service looper and the io
+   * loopers, the shared looper keeps the one the Context was built with
+   */
+  NetworkService(light::core::Context &ctx, int thread_count,
+                 int io_looper_count = 0,
+                 light::network::LooperGroup::BalancePolicy policy =
+                     light::network::LooperGroup::ROUND_ROBIN,
+                 light::network::SchedulerType scheduler_type =
+                     light::network::SLICE_SCHEDULER);
 
 	~NetworkService();
 
+  /**
+   * @brief where the service threads and the io looper threads run, must be
+   * called before init(). Service threads take placement slots 0 to
+   * thread_count - 1 and io loopers the following ones.
+   */
+  void set_placement(const light::utils::ThreadPlacement &placement) {
+    placement_ = placement;
+  }
+
+  /**
+   * @brief idle, read and write timeouts of tcp connections in microseconds,
+   * 0 turns one off. Must be called before init(). A connection that runs
+   * out of one gets a NET_MSG_TYPE_EXECPTION with timed_out and is closed.
+   */
+  void set_tcp_timeouts(light::network::Timestamp idle,
+                        light::network::Timestamp read,
+                        light::network::Timestamp write) {
+    tcp_timeouts_[light::network::Deadlines::IDLE] = idle;
+    tcp_timeouts_[light::network::Deadlines::READ] = read;
+    tcp_timeouts_[light::network::Deadlines::WRITE] = write;
+  }
+
   std::error_code init();
 
   std::error_code fini();
@@ -98,6 +140,12 @@ private:
 
   void on_loop();
 
+  // wraps a new host, its socket wakes the looper and on_loop() services it
+  std::shared_ptr<ENetHost> watch_enet_host(ENetHost *host);
+
+  // one shot at timeout (enet time) while pending, cancelled otherwise
+  void arm_enet_timer(bool pending, enet_uint32 timeout);
+
   void forward_message(const NetworkServiceMessage &msg, uint32_t opaque);
 
   void forward_data_message(NetworkServiceMessageType type, uint32_t opaque,
@@ -128,8 +176,16 @@ private:
 
   void handle_tcp_close(uint32_t handle);
 
-  void async_read_tcp_connection(light::network::TcpConnection *conn,
-                                 uint32_t handle);
+  void on_tcp_error(uint32_t handle, const std::error_code &ec);
+
+  void on_tcp_close(uint32_t handle);
+
+  void on_tcp_timeout(uint32_t handle, light::network::Deadlines::Type type);
+
+  light::network::Deadlines *get_tcp_deadlines(light::network::Looper &looper);
+
+  void start_reading_tcp_connection(light::network::TcpConnection *conn,
+                                    uint32_t handle, uint32_t opaque);
 
   std::tuple<uint32_t, light::network::TcpConnection *>
   install_tcp_connection(int sockfd, uint32_t opaque);
@@ -151,6 +207,12 @@ private:
 	  uint32_t opaque;
   };
   std::unique_ptr<light::network::Looper> internal_looper_;
+  // declared before the connection maps, connections refer to its loopers
+  std::unique_ptr<light::network::LooperGroup> io_group_;
+  // one per looper running tcp connections, empty without timeouts
+  std::vector<std::unique_ptr<light::network::Deadlines>> tcp_deadlines_;
+  light::network::Timestamp
+      tcp_timeouts_[light::network::Deadlines::TYPE_COUNT];
 
   std::unordered_map<uint32_t, ConnectionContainer<light::network::Acceptor> > acceptor_map_;
   std::unordered_map<uint32_t, ConnectionContainer<ENetHost> > enet_host_map_;
@@ -164,12 +226,17 @@ private:
   uint32_t last_socket_id_;
   uint32_t last_callback_idx_;
   int loop_idx_;
+  // wakes on_loop() when enet has to resend or ping and no datagram shows up
+  light::network::TimerId enet_timer_;
+  enet_uint32 enet_timeout_;
+  // events one on_loop() takes from a host before it lets the loop go on
+  enum { ENET_EVENT_BUDGET = 64 };
   static light::utils::FixedAllocator<2 * 1024> fixed_alloc_;
   std::set<uint32_t> active_close_handlers_;
 
   int thread_count_;
   std::vector<std::thread> threads_;
-  
+  light::utils::ThreadPlacement placement_;
 };
 
 } /* core */
@@ -14,7 +14,7 @@ public:
   ~FixedAllocator() {
     std::lock_guard<std::mutex> lock_guard(lock_);
     while (free_count_) {
-      auto *old = free_list_->data;
+      auto *old = free_list_;
       free_list_ = free_list_->next;
       delete old;
       --free_count_;
@@ -42,11 +42,10 @@ public:
     free_list_ = node;
     ++free_count_;
     while (free_count_ >= MAX_RESERVE) {
-      auto *tmp_node = free_list_->data;
+      auto *tmp_node = free_list_;
       free_list_ = free_list_->next;
       delete tmp_node;
-      --free_list_;
-			--free_count_;
+      --free_count_;
     }
   }
 
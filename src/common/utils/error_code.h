@@ -15,6 +15,7 @@ ADD_ERROR_CODE_DEF(not_found, "Not Found")
 ADD_ERROR_CODE_DEF(fd_set_failure, "FD SET Failure")
 ADD_ERROR_CODE_DEF(name_occupied, "name occupied")
 ADD_ERROR_CODE_DEF(unknown, "Unknown")
+ADD_ERROR_CODE_DEF(queue_full, "Queue full")
 
 #undef ADD_ERROR_CODE_DEF
 
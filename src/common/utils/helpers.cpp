@@ -1,4 +1,5 @@
 #include <chrono>
+#include <time.h>
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>
 #endif
@@ -12,6 +13,16 @@
 namespace light {
 namespace utils {
 
+namespace {
+#ifdef CLOCK_MONOTONIC
+uint64_t clock_timestamp(clockid_t clock) {
+  struct timespec ts;
+  ::clock_gettime(clock, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+#endif
+} /* anonymous */
+
 int set_nonblocking(int fd) {
 #ifdef WIN32
   u_long flag = 1;
@@ -47,6 +58,25 @@ uint64_t get_timestamp() {
       .count();
 }
 
+uint64_t get_monotonic_timestamp() {
+#ifdef CLOCK_MONOTONIC
+  return clock_timestamp(CLOCK_MONOTONIC);
+#else
+  return std::chrono::time_point_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now())
+      .time_since_epoch()
+      .count();
+#endif
+}
+
+uint64_t get_coarse_monotonic_timestamp() {
+#ifdef CLOCK_MONOTONIC_COARSE
+  return clock_timestamp(CLOCK_MONOTONIC_COARSE);
+#else
+  return get_monotonic_timestamp();
+#endif
+}
+
 int SocketGlobalInitialize() {
 #ifdef WIN32
   WORD versionRequested = MAKEWORD(1, 1);
@@ -20,8 +20,25 @@ public:
 private:
   std::function<void(void)> f_;
 };
+/**
+ * @brief wall clock microseconds since the epoch, for display. Use
+ * get_monotonic_timestamp() to measure time, the wall clock may jump.
+ */
 uint64_t get_timestamp();
 
+/**
+ * @brief CLOCK_MONOTONIC microseconds, the clock of timers and the looper's
+ * timerfd
+ */
+uint64_t get_monotonic_timestamp();
+
+/**
+ * @brief CLOCK_MONOTONIC_COARSE microseconds where there is one: the time
+ * of the last scheduler tick, a few milliseconds resolution but no clock
+ * read. Same epoch as get_monotonic_timestamp().
+ */
+uint64_t get_coarse_monotonic_timestamp();
+
 template <typename T> struct icast_identity { typedef T type; };
 
 int SocketGlobalInitialize();
@@ -1,51 +1,176 @@
 #pragma once
+#include <atomic>
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+#include "utils/noncopyable.h"
 #include "utils/platform.h"
 namespace light {
 namespace utils {
 
-#if 0
-		template<typename T>
-			struct LockFreeQueueNode {
-
-				LockFreeQueueNode(T&& t): next(nullptr), data(std::forward<T>(t)) {}
-
-				LockFreeQueueNode next;
-				T data;
-			};
-
-		template<typename T>
-			class LockFreeQueue {
-			public:
-				LockFreeQueue(): head_(nullptr), tail_(nullptr) {}
-
-				bool empty() {
-					return head_ == nullptr;
-				}
-
-				void push_back(T&& t) {
-					LockFreeQueueNode<T> *node = new LockFreeQueueNode(std::forward<T>(t));
-					if (compare_and_swap(tail_, nullptr, node)) {
-						head_ = node;
-						return;
-					}
-
-					LockFreeQueueNode<T> *old_tail = tail_.load(std::memory_order_release);
-					LockFreeQueueNode<T> *p = old_tail;
-					do {
-						while (p->next != nullptr) {
-							p = p->next;
-						}
-					} while(compare_and_swap(p->next, nullptr, node));
-				}
-
-				T front() {
-				}
-
-			private:
-				LockFreeQueueNode<T>* head_;
-				LockFreeQueueNode<T>* tail_;
-			};
-
-#endif
+/**
+ * @brief unbounded multi-producer single-consumer queue (Dmitry Vyukov's
+ * node based algorithm). push_back() is wait-free for producers: one
+ * exchange on head_ and one store to link the node. pop_front() must only
+ * be called by one thread at a time.
+ *
+ * A producer preempted between the two steps hides the nodes pushed after
+ * it, pop_front() reports empty until the link is published, callers that
+ * need to be told about new items should signal after push_back().
+ *
+ * If capacity is not 0, try_push_back() refuses new items once size()
+ * reaches it. The size is maintained with relaxed atomics, the bound is
+ * therefore approximate under contention.
+ */
+template <typename T> class LockFreeQueue : public NonCopyable {
+  struct Node {
+    Node() : next(nullptr) {}
+    std::atomic<Node *> next;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+    T *data() { return reinterpret_cast<T *>(&storage); }
+  };
+
+public:
+  explicit LockFreeQueue(size_t capacity = 0)
+      : head_(new Node), tail_(head_.load()), size_(0), capacity_(capacity) {}
+
+  ~LockFreeQueue() {
+    while (pop_front()) {
+    }
+    delete tail_;
+  }
+
+  template <typename U> void push_back(U &&u) {
+    Node *node = new Node;
+    new (node->data()) T(std::forward<U>(u));
+    size_.fetch_add(1, std::memory_order_relaxed);
+    Node *prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+  }
+
+  template <typename U> bool try_push_back(U &&u) {
+    if (capacity_ && size() >= capacity_)
+      return false;
+    push_back(std::forward<U>(u));
+    return true;
+  }
+
+  /**
+   * @brief consumer only
+   */
+  bool pop_front(T &t) {
+    Node *tail = tail_;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+      return false;
+    t = std::move(*next->data());
+    next->data()->~T();
+    tail_ = next;
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    delete tail;
+    return true;
+  }
+
+  /**
+   * @brief consumer only, drop the front item
+   */
+  bool pop_front() {
+    Node *tail = tail_;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+      return false;
+    next->data()->~T();
+    tail_ = next;
+    size_.fetch_sub(1, std::memory_order_relaxed);
+    delete tail;
+    return true;
+  }
+
+  bool empty() const { return size() == 0; }
+
+  size_t size() const {
+    auto sz = size_.load(std::memory_order_relaxed);
+    return sz > 0 ? static_cast<size_t>(sz) : 0;
+  }
+
+  size_t capacity() const { return capacity_; }
+
+  void set_capacity(size_t capacity) { capacity_ = capacity; }
+
+private:
+  std::atomic<Node *> head_;
+  // consumer side, the node in front of the first item
+  Node *tail_;
+  std::atomic<ptrdiff_t> size_;
+  size_t capacity_;
+};
+
+/**
+ * @brief link embedded into the items of an IntrusiveLockFreeQueue
+ */
+struct LockFreeNode {
+  LockFreeNode() : lockfree_next(nullptr) {}
+  std::atomic<LockFreeNode *> lockfree_next;
+};
+
+/**
+ * @brief intrusive version of LockFreeQueue, the queue never allocates, an
+ * item is linked through its own LockFreeNode and may sit in at most one
+ * queue at a time. Same producer/consumer rules as LockFreeQueue.
+ */
+class IntrusiveLockFreeQueue : public NonCopyable {
+public:
+  IntrusiveLockFreeQueue() : head_(&stub_), tail_(&stub_), stub_() {}
+
+  void push_back(LockFreeNode *node) {
+    node->lockfree_next.store(nullptr, std::memory_order_relaxed);
+    LockFreeNode *prev = head_.exchange(node, std::memory_order_acq_rel);
+    prev->lockfree_next.store(node, std::memory_order_release);
+  }
+
+  /**
+   * @brief consumer only
+   *
+   * @return nullptr if empty or if the next item is still being linked
+   */
+  LockFreeNode *pop_front() {
+    LockFreeNode *tail = tail_;
+    LockFreeNode *next = tail->lockfree_next.load(std::memory_order_acquire);
+    if (tail == &stub_) {
+      if (next == nullptr)
+        return nullptr;
+      tail_ = next;
+      tail = next;
+      next = next->lockfree_next.load(std::memory_order_acquire);
+    }
+    if (next) {
+      tail_ = next;
+      return tail;
+    }
+    if (tail != head_.load(std::memory_order_acquire))
+      return nullptr;
+    // tail is the last item, put the stub behind it so it can be unlinked
+    push_back(&stub_);
+    next = tail->lockfree_next.load(std::memory_order_acquire);
+    if (next) {
+      tail_ = next;
+      return tail;
+    }
+    return nullptr;
+  }
+
+  bool empty() const {
+    return tail_ == &stub_ &&
+           stub_.lockfree_next.load(std::memory_order_acquire) == nullptr;
+  }
+
+private:
+  std::atomic<LockFreeNode *> head_;
+  LockFreeNode *tail_;
+  LockFreeNode stub_;
+};
+
 } /* utils */
 } /* light */
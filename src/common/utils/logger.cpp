@@ -5,7 +5,7 @@
 #include <sys/time.h>
 #endif
 #include <string.h>
-#include <network/timer.h>
+#include "utils/helpers.h"
 
 namespace light {
 namespace utils {
@@ -14,13 +14,19 @@ void set_log_level(int level) { global_log_level = level; }
 
 const char *LocalLoggerProxy::get_time_str() {
   static thread_local char t_buff[32];
-  memset(t_buff, 0, 32);
+  // the date part only changes once a second
+  static thread_local time_t t_sec = 0;
+  static thread_local int t_len = 0;
   uint64_t stamp = get_timestamp();
   time_t sec = static_cast<time_t>(stamp / 1000000);
   int64_t usec = stamp % 1000000;
-  struct tm *tm = localtime(&sec);
-  int len = strftime(t_buff, sizeof(t_buff), "%m/%d/%y %H:%M:%S", tm);
-  snprintf(&t_buff[len], 32 - len, ".%ld", static_cast<long>(usec));
+  if (sec != t_sec || !t_len) {
+    memset(t_buff, 0, 32);
+    struct tm *tm = localtime(&sec);
+    t_len = strftime(t_buff, sizeof(t_buff), "%m/%d/%y %H:%M:%S", tm);
+    t_sec = sec;
+  }
+  snprintf(&t_buff[t_len], 32 - t_len, ".%ld", static_cast<long>(usec));
   return t_buff;
 }
 }
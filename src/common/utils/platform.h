@@ -10,5 +10,6 @@ struct iovec {
 };
 
 unsigned int writev(int fd, struct iovec *, unsigned int);
+unsigned int readv(int fd, struct iovec *, unsigned int);
 #endif
 int socketclose(int fd);
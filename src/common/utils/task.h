@@ -0,0 +1,195 @@
+#pragma once
+#include <assert.h>
+#include <cstddef>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+namespace light {
+namespace utils {
+
+namespace detail {
+template <size_t... I> struct IndexSequence {};
+
+template <size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+
+template <size_t... I> struct MakeIndexSequence<0, I...> {
+  typedef IndexSequence<I...> type;
+};
+
+template <typename F, typename... A>
+auto invoke(F &&f, A &&... a)
+    -> decltype(std::forward<F>(f)(std::forward<A>(a)...)) {
+  return std::forward<F>(f)(std::forward<A>(a)...);
+}
+
+// member functions are bound to a pointer to the object, like std::bind
+template <typename M, typename C, typename P, typename... A>
+auto invoke(M C::*pm, P &&obj, A &&... a)
+    -> decltype(((*std::forward<P>(obj)).*pm)(std::forward<A>(a)...)) {
+  return ((*std::forward<P>(obj)).*pm)(std::forward<A>(a)...);
+}
+
+/**
+ * @brief a function and its arguments stored by value. The call moves the
+ * arguments out, so they may be move-only and the call is done at most once.
+ */
+template <typename F, typename... A> class BoundCall {
+public:
+  template <typename G, typename... B>
+  explicit BoundCall(G &&g, B &&... b)
+      : func_(std::forward<G>(g)), args_(std::forward<B>(b)...) {}
+
+  void operator()() {
+    call(typename MakeIndexSequence<sizeof...(A)>::type());
+  }
+
+private:
+  template <size_t... I> void call(IndexSequence<I...>) {
+    detail::invoke(func_, std::move(std::get<I>(args_))...);
+  }
+
+  F func_;
+  std::tuple<A...> args_;
+};
+} /* detail */
+
+/**
+ * @brief move-only replacement for std::function<void()> used to post work
+ * to a Looper. Callables up to INLINE_SIZE bytes are stored in place, which
+ * covers a member function, its object and a few arguments, larger ones
+ * fall back to the heap.
+ */
+class Task {
+  struct Ops {
+    void (*invoke)(void *);
+    void (*move)(void *dst, void *src);
+    void (*destroy)(void *);
+  };
+
+public:
+  enum { INLINE_SIZE = 96 };
+
+  typedef std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type
+      storage_t;
+
+  template <typename F> struct is_inline {
+    static const bool value = sizeof(F) <= sizeof(storage_t) &&
+                              alignof(F) <= alignof(storage_t) &&
+                              std::is_nothrow_move_constructible<F>::value;
+  };
+
+  Task() : ops_(nullptr) {}
+
+  template <typename F, typename = typename std::enable_if<!std::is_same<
+                            typename std::decay<F>::type, Task>::value>::type>
+  Task(F &&f) : ops_(nullptr) {
+    typedef typename std::decay<F>::type callable_t;
+    construct<callable_t>(std::forward<F>(f),
+                          std::integral_constant<bool,
+                                                 is_inline<callable_t>::value>());
+  }
+
+  Task(Task &&other) noexcept : ops_(other.ops_) {
+    if (ops_) {
+      ops_->move(&storage_, &other.storage_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      reset();
+      if (other.ops_) {
+        other.ops_->move(&storage_, &other.storage_);
+        ops_ = other.ops_;
+        other.ops_ = nullptr;
+      }
+    }
+    return *this;
+  }
+
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  ~Task() { reset(); }
+
+  void operator()() {
+    assert(ops_);
+    ops_->invoke(&storage_);
+  }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+  void reset() {
+    if (ops_) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+private:
+  template <typename F> struct InlineOps {
+    static void invoke(void *p) { (*static_cast<F *>(p))(); }
+    static void move(void *dst, void *src) {
+      new (dst) F(std::move(*static_cast<F *>(src)));
+      static_cast<F *>(src)->~F();
+    }
+    static void destroy(void *p) { static_cast<F *>(p)->~F(); }
+    static const Ops ops;
+  };
+
+  template <typename F> struct HeapOps {
+    static void invoke(void *p) { (**static_cast<F **>(p))(); }
+    static void move(void *dst, void *src) {
+      *static_cast<F **>(dst) = *static_cast<F **>(src);
+    }
+    static void destroy(void *p) { delete *static_cast<F **>(p); }
+    static const Ops ops;
+  };
+
+  template <typename F, typename G> void construct(G &&g, std::true_type) {
+    new (&storage_) F(std::forward<G>(g));
+    ops_ = &InlineOps<F>::ops;
+  }
+
+  template <typename F, typename G> void construct(G &&g, std::false_type) {
+    *reinterpret_cast<F **>(&storage_) = new F(std::forward<G>(g));
+    ops_ = &HeapOps<F>::ops;
+  }
+
+private:
+  storage_t storage_;
+  const Ops *ops_;
+};
+
+template <typename F>
+const Task::Ops Task::InlineOps<F>::ops = {&Task::InlineOps<F>::invoke,
+                                           &Task::InlineOps<F>::move,
+                                           &Task::InlineOps<F>::destroy};
+
+template <typename F>
+const Task::Ops Task::HeapOps<F>::ops = {&Task::HeapOps<F>::invoke,
+                                         &Task::HeapOps<F>::move,
+                                         &Task::HeapOps<F>::destroy};
+
+/**
+ * @brief bind func and args into a Task, arguments are decay-copied (or
+ * moved) into the task and moved into the call
+ */
+template <typename FUNC> Task make_task(FUNC &&func) {
+  return Task(std::forward<FUNC>(func));
+}
+
+template <typename FUNC, typename ARG, typename... ARGS>
+Task make_task(FUNC &&func, ARG &&arg, ARGS &&... args) {
+  return Task(detail::BoundCall<typename std::decay<FUNC>::type,
+                                typename std::decay<ARG>::type,
+                                typename std::decay<ARGS>::type...>(
+      std::forward<FUNC>(func), std::forward<ARG>(arg),
+      std::forward<ARGS>(args)...));
+}
+
+} /* utils */
+} /* light */
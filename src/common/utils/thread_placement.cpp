@@ -0,0 +1,213 @@
+#include "config.h"
+#include <algorithm>
+#include <errno.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include "utils/error_code.h"
+#include "utils/thread_placement.h"
+#ifdef HAVE_PTHREAD_SETAFFINITY
+#include <pthread.h>
+#include <sched.h>
+#endif
+#ifdef HAVE_SET_MEMPOLICY
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace light {
+namespace utils {
+
+namespace {
+// parses the kernel cpulist format, e.g. "0-3,8,10-11"
+std::vector<int> parse_cpu_list(const std::string &list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    if (range.empty())
+      continue;
+    int first = 0, last = 0;
+    auto dash = range.find('-');
+    try {
+      first = std::stoi(range.substr(0, dash));
+      last = dash == std::string::npos ? first
+                                       : std::stoi(range.substr(dash + 1));
+    } catch (const std::exception &) {
+      continue;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+bool read_cpu_list(const std::string &path, std::vector<int> &cpus) {
+  std::ifstream in(path);
+  std::string line;
+  if (!in || !std::getline(in, line))
+    return false;
+  cpus = parse_cpu_list(line);
+  return true;
+}
+
+// drop the cpus the process may not run on, taskset and cpusets shrink the
+// affinity mask below the online cpus
+void keep_allowed_cpus(std::vector<std::vector<int>> &nodes) {
+#ifdef HAVE_PTHREAD_SETAFFINITY
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (::sched_getaffinity(0, sizeof set, &set) != 0)
+    return;
+  std::vector<std::vector<int>> allowed(nodes.size());
+  bool any = false;
+  for (size_t node = 0; node < nodes.size(); ++node) {
+    for (int cpu : nodes[node]) {
+      if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &set)) {
+        allowed[node].push_back(cpu);
+        any = true;
+      }
+    }
+  }
+  // a mask naming none of them is not worth trusting
+  if (any)
+    nodes.swap(allowed);
+#else
+  (void)nodes;
+#endif
+}
+} /* anonymous */
+
+const CpuTopology &CpuTopology::get() {
+  static CpuTopology topology;
+  return topology;
+}
+
+CpuTopology::CpuTopology() : nodes_(), cpu_node_() {
+  const std::string sys_node = "/sys/devices/system/node/";
+  std::vector<int> online;
+  if (read_cpu_list(sys_node + "online", online)) {
+    for (int node : online) {
+      std::vector<int> cpus;
+      if (!read_cpu_list(sys_node + "node" + std::to_string(node) + "/cpulist",
+                         cpus) ||
+          cpus.empty())
+        continue;
+      // keep the kernel numbering, memory policies use it
+      if (node >= static_cast<int>(nodes_.size()))
+        nodes_.resize(node + 1);
+      nodes_[node] = std::move(cpus);
+    }
+  }
+  if (nodes_.empty()) {
+    std::vector<int> cpus;
+    if (!read_cpu_list("/sys/devices/system/cpu/online", cpus) ||
+        cpus.empty()) {
+      int count = (std::max)(std::thread::hardware_concurrency(), 1u);
+      for (int cpu = 0; cpu < count; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    }
+    nodes_.emplace_back(std::move(cpus));
+  }
+  keep_allowed_cpus(nodes_);
+
+  for (size_t node = 0; node < nodes_.size(); ++node) {
+    for (int cpu : nodes_[node]) {
+      if (cpu >= static_cast<int>(cpu_node_.size()))
+        cpu_node_.resize(cpu + 1, -1);
+      cpu_node_[cpu] = static_cast<int>(node);
+    }
+  }
+}
+
+std::vector<int> ThreadPlacement::cpus_for(int thread_idx, int &node) const {
+  const CpuTopology &topology = CpuTopology::get();
+  node = -1;
+
+  auto allowed = [this](int cpu) {
+    return std::find(excluded_cpus.begin(), excluded_cpus.end(), cpu) ==
+           excluded_cpus.end();
+  };
+  std::vector<std::vector<int>> usable;
+  for (int i = 0; i < topology.node_count(); ++i) {
+    std::vector<int> cpus;
+    for (int cpu : topology.cpus_of_node(i)) {
+      if (allowed(cpu))
+        cpus.push_back(cpu);
+    }
+    if (!cpus.empty())
+      usable.emplace_back(std::move(cpus));
+  }
+  if (usable.empty())
+    return std::vector<int>();
+
+  switch (policy) {
+  case PIN_CORE: {
+    std::vector<int> all;
+    for (auto &cpus : usable) {
+      all.insert(all.end(), cpus.begin(), cpus.end());
+    }
+    int cpu = all[thread_idx % all.size()];
+    node = topology.node_of_cpu(cpu);
+    return std::vector<int>(1, cpu);
+  }
+  case SPREAD_NUMA: {
+    auto &cpus = usable[thread_idx % usable.size()];
+    node = topology.node_of_cpu(cpus.front());
+    return cpus;
+  }
+  case NONE:
+  default: {
+    if (excluded_cpus.empty())
+      return std::vector<int>();
+    std::vector<int> all;
+    for (auto &cpus : usable) {
+      all.insert(all.end(), cpus.begin(), cpus.end());
+    }
+    if (usable.size() == 1)
+      node = topology.node_of_cpu(all.front());
+    return all;
+  }
+  }
+}
+
+std::error_code ThreadPlacement::apply(int thread_idx) const {
+  int node;
+  std::vector<int> cpus = cpus_for(thread_idx, node);
+  if (cpus.empty())
+    return LS_OK_ERROR();
+
+#ifdef HAVE_PTHREAD_SETAFFINITY
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  }
+  int ret = ::pthread_setaffinity_np(::pthread_self(), sizeof set, &set);
+  if (ret != 0)
+    return LS_GENERIC_ERROR(ret);
+#endif
+
+#ifdef HAVE_SET_MEMPOLICY
+  // a single node box has nothing to prefer
+  if (node >= 0 && CpuTopology::get().node_count() > 1) {
+    unsigned long mask[16] = {0};
+    const int bits = static_cast<int>(sizeof(unsigned long) * 8);
+    if (node < bits * 16) {
+      mask[node / bits] |= 1UL << (node % bits);
+      if (::syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                    static_cast<unsigned long>(bits * 16)) != 0)
+        return LS_GENERIC_ERROR(errno);
+    }
+  }
+#endif
+  return LS_OK_ERROR();
+}
+
+} /* utils */
+} /* light */
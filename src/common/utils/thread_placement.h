@@ -0,0 +1,75 @@
+#pragma once
+#include <system_error>
+#include <vector>
+#include "utils/noncopyable.h"
+
+namespace light {
+namespace utils {
+
+/**
+ * @brief online cpus grouped by NUMA node, read once from
+ * /sys/devices/system/node. Machines without that information are seen as a
+ * single node holding every online cpu. Only the cpus in the affinity mask
+ * of the process at that time are kept, a node may end up empty.
+ */
+class CpuTopology : public NonCopyable {
+public:
+  static const CpuTopology &get();
+
+  int cpu_count() const { return static_cast<int>(cpu_node_.size()); }
+
+  int node_count() const { return static_cast<int>(nodes_.size()); }
+
+  /**
+   * @return -1 if the cpu is offline, unknown or not allowed
+   */
+  int node_of_cpu(int cpu) const {
+    return cpu >= 0 && cpu < cpu_count() ? cpu_node_[cpu] : -1;
+  }
+
+  const std::vector<int> &cpus_of_node(int node) const { return nodes_[node]; }
+
+private:
+  CpuTopology();
+
+  // node id -> allowed online cpus, ascending, empty for missing ids
+  std::vector<std::vector<int>> nodes_;
+  // cpu -> node
+  std::vector<int> cpu_node_;
+};
+
+/**
+ * @brief where the threads driving a Looper run. The n-th thread of a
+ * service or group calls apply(n) before entering the loop.
+ *
+ * PIN_CORE binds every thread to a single cpu, round robin over the allowed
+ * cpus. SPREAD_NUMA deals the threads over the NUMA nodes, a thread may move
+ * between the allowed cpus of its node but never leaves it. Cpus listed in
+ * excluded_cpus are never used, with NONE that is the only restriction.
+ *
+ * Once a thread is bound to a node its memory policy prefers that node, so
+ * whatever it allocates for itself (scheduler deques, buffers) stays local.
+ */
+struct ThreadPlacement {
+  enum Policy { NONE, PIN_CORE, SPREAD_NUMA };
+
+  ThreadPlacement(Policy p = NONE) : policy(p), excluded_cpus() {}
+
+  /**
+   * @param node set to the node the cpus belong to, -1 if they span nodes
+   *
+   * @return cpus the thread may run on, empty means no restriction
+   */
+  std::vector<int> cpus_for(int thread_idx, int &node) const;
+
+  /**
+   * @brief bind the calling thread
+   */
+  std::error_code apply(int thread_idx) const;
+
+  Policy policy;
+  std::vector<int> excluded_cpus;
+};
+
+} /* utils */
+} /* light */
@@ -0,0 +1,138 @@
+#pragma once
+#include <assert.h>
+#include <atomic>
+#include <memory>
+#include <stdint.h>
+#include <type_traits>
+#include <vector>
+#include "utils/noncopyable.h"
+namespace light {
+namespace utils {
+
+/**
+ * @brief Chase-Lev work stealing deque, with the memory orderings from
+ * "Correct and Efficient Work-Stealing for Weak Memory Models" (Le et al.).
+ *
+ * The owner thread push()es and take()s at the bottom (LIFO), any other
+ * thread steal()s from the top (FIFO). T must be trivially copyable, it is
+ * usually a pointer. The buffer grows when full, retired buffers are kept
+ * until destruction because a stealer may still read from them.
+ */
+template <typename T> class WorkStealingDeque : public NonCopyable {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "WorkStealingDeque holds trivially copyable items only");
+
+  struct Array {
+    explicit Array(int64_t cap) : capacity(cap), buf(new std::atomic<T>[cap]) {}
+
+    T get(int64_t idx) const {
+      return buf[idx & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t idx, T t) {
+      buf[idx & (capacity - 1)].store(t, std::memory_order_relaxed);
+    }
+
+    Array *grow(int64_t bottom, int64_t top) const {
+      Array *arr = new Array(capacity * 2);
+      for (int64_t i = top; i != bottom; ++i) {
+        arr->put(i, get(i));
+      }
+      return arr;
+    }
+
+    int64_t capacity;
+    std::unique_ptr<std::atomic<T>[]> buf;
+  };
+
+public:
+  /**
+   * @param capacity initial capacity, must be a power of two
+   */
+  explicit WorkStealingDeque(int64_t capacity = 256)
+      : top_(0), bottom_(0), array_(new Array(capacity)), retired_() {
+    assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+  }
+
+  ~WorkStealingDeque() { delete array_.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief owner only
+   */
+  void push(T t) {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t_idx = top_.load(std::memory_order_acquire);
+    Array *arr = array_.load(std::memory_order_relaxed);
+    if (b - t_idx > arr->capacity - 1) {
+      Array *bigger = arr->grow(b, t_idx);
+      retired_.emplace_back(arr);
+      array_.store(bigger, std::memory_order_release);
+      arr = bigger;
+    }
+    arr->put(b, t);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief owner only, pop the most recently pushed item
+   */
+  bool take(T &t) {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array *arr = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t_idx = top_.load(std::memory_order_relaxed);
+    if (t_idx > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    t = arr->get(b);
+    if (t_idx == b) {
+      // last item, race against stealers
+      bool won = top_.compare_exchange_strong(t_idx, t_idx + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed);
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return won;
+    }
+    return true;
+  }
+
+  /**
+   * @brief any thread, pop the oldest item. May fail spuriously when racing
+   * with another stealer or the owner.
+   */
+  bool steal(T &t) {
+    int64_t t_idx = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if (t_idx >= b)
+      return false;
+    Array *arr = array_.load(std::memory_order_acquire);
+    T item = arr->get(t_idx);
+    if (!top_.compare_exchange_strong(t_idx, t_idx + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+      return false;
+    t = item;
+    return true;
+  }
+
+  size_t size() const {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t_idx = top_.load(std::memory_order_relaxed);
+    return b > t_idx ? static_cast<size_t>(b - t_idx) : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+
+private:
+  std::atomic<int64_t> top_;
+  std::atomic<int64_t> bottom_;
+  std::atomic<Array *> array_;
+  std::vector<std::unique_ptr<Array>> retired_;
+};
+
+} /* utils */
+} /* light */
@@ -1,8 +1,15 @@
 #include <gtest/gtest.h>
 #include <iostream>
+#include <random>
+#include <set>
+#include <string.h>
 #include <thread>
 #include "network/acceptor.h"
+#include "network/deadlines.h"
+#include "network/epoll_poller.h"
+#include "network/io_uring_poller.h"
 #include "network/looper.h"
+#include "network/looper_group.h"
 #include "network/socket.h"
 #include "network/tcp_client.h"
 #include "network/tcp_connection.h"
@@ -155,3 +162,1345 @@ TEST(Looper, demo) { /*{{{*/
   looper.add_timer(ec, 1500000LL, 0, [&looper] { DLOG(INFO) << "one shot"; });
   looper.loop();
 } /*}}}*/
+
+TEST(LooperGroup, balance) { /*{{{*/
+  LooperGroup group(2, LooperGroup::LEAST_LOAD);
+  group.start();
+  std::atomic_int count(0);
+  for (int i = 0; i < 4; ++i) {
+    group.acquire_looper().post([&count] { count.fetch_add(1); });
+  }
+  EXPECT_EQ(2, group.get_load(0));
+  EXPECT_EQ(2, group.get_load(1));
+  group.release_looper(group.get_looper(1));
+  EXPECT_EQ(&group.get_looper(1), &group.acquire_looper());
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  group.stop();
+  EXPECT_EQ(4, count.load());
+} /*}}}*/
+
+TEST(LooperGroup, scheduler) { /*{{{*/
+  LooperGroup group(2, LooperGroup::ROUND_ROBIN, WORK_STEALING_SCHEDULER);
+  group.start();
+  std::atomic_int count(0);
+  for (int i = 0; i < 8; ++i) {
+    group.acquire_looper().post([&count] { count.fetch_add(1); });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  group.stop();
+  EXPECT_EQ(8, count.load());
+} /*}}}*/
+
+TEST(Looper, scheduler) { /*{{{*/
+  for (auto type : {SLICE_SCHEDULER, WORK_STEALING_SCHEDULER}) {
+    Looper looper(type);
+    std::atomic_int count(0);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < 3; ++i) {
+      workers.emplace_back([&looper] { looper.loop(); });
+    }
+    // posts from workers land on their own deque, others steal them
+    for (int i = 0; i < 100; ++i) {
+      looper.post([&looper, &count] {
+        for (int j = 0; j < 10; ++j) {
+          looper.post([&count] { count.fetch_add(1); });
+        }
+      });
+    }
+    while (count.load() < 1000) {
+      std::this_thread::yield();
+    }
+    looper.stop();
+    for (auto &thd : workers) {
+      thd.join();
+    }
+    EXPECT_EQ(1000, count.load());
+  }
+} /*}}}*/
+
+TEST(Looper, strand) { /*{{{*/
+  Looper looper;
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 4; ++i) {
+    workers.emplace_back([&looper] { looper.loop(); });
+  }
+  const int strand_count = 8, per_strand = 2000;
+  std::vector<std::vector<int>> seen(strand_count);
+  std::vector<std::atomic_int> running(strand_count);
+  std::atomic_int overlap(0), done(0);
+  std::vector<std::thread> producers;
+  for (int s = 0; s < strand_count; ++s) {
+    running[s].store(0);
+    producers.emplace_back([&, s] {
+      Strand &strand = looper.get_strand(s + 1);
+      for (int i = 0; i < per_strand; ++i) {
+        strand.post([&, s, i] {
+          if (running[s].fetch_add(1) != 0)
+            overlap.fetch_add(1);
+          seen[s].push_back(i);
+          running[s].fetch_sub(1);
+          done.fetch_add(1);
+        });
+      }
+    });
+  }
+  for (auto &thd : producers) {
+    thd.join();
+  }
+  while (done.load() < strand_count * per_strand) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  for (auto &thd : workers) {
+    thd.join();
+  }
+  EXPECT_EQ(0, overlap.load());
+  for (int s = 0; s < strand_count; ++s) {
+    EXPECT_EQ(per_strand, static_cast<int>(seen[s].size()));
+    bool ordered = true;
+    for (int i = 0; i < per_strand && i < static_cast<int>(seen[s].size()); ++i) {
+      ordered = ordered && seen[s][i] == i;
+    }
+    EXPECT_TRUE(ordered);
+  }
+} /*}}}*/
+
+TEST(Looper, wakeup) { /*{{{*/
+  Looper looper;
+  std::thread worker([&looper] { looper.loop(); });
+  const int posts = 10000;
+  std::atomic_int done(0);
+  for (int i = 0; i < posts; ++i) {
+    looper.post([&done] { done.fetch_add(1); });
+  }
+  while (done.load() < posts) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+  EXPECT_EQ(static_cast<uint64_t>(posts),
+            looper.wakeup_count() + looper.suppressed_wakeup_count());
+  EXPECT_TRUE(looper.wakeup_count() < static_cast<uint64_t>(posts));
+} /*}}}*/
+
+TEST(Looper, busy_poll) { /*{{{*/
+  Looper looper;
+  looper.set_busy_poll(500);
+  std::thread worker([&looper] { looper.loop(); });
+  std::atomic_int done(0);
+  for (int i = 0; i < 1000; ++i) {
+    looper.post([&done] { done.fetch_add(1); });
+    if (i % 100 == 0)
+      std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+  while (done.load() < 1000) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+  EXPECT_EQ(1000, done.load());
+  EXPECT_TRUE(looper.busy_poll_budget() <= 500);
+} /*}}}*/
+
+TEST(Looper, phases) { /*{{{*/
+  Looper looper;
+  std::vector<LoopPhase> phases;
+  std::atomic_int checks(0);
+  looper.add_loop_hook(LOOP_PHASE_PREPARE,
+                       [&phases] { phases.push_back(LOOP_PHASE_PREPARE); });
+  looper.add_loop_hook(LOOP_PHASE_CHECK, [&] {
+    phases.push_back(LOOP_PHASE_CHECK);
+    // keep iterating without any event until 10 rounds are done
+    if (checks.fetch_add(1) + 1 < 10)
+      looper.request_next_iteration();
+  });
+  int idle = looper.add_loop_hook(LOOP_PHASE_IDLE, [] {});
+  looper.remove_loop_hook(idle);
+
+  std::thread worker([&looper] { looper.loop(); });
+  while (checks.load() < 10) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+
+  EXPECT_TRUE(phases.size() >= 20);
+  bool ordered = true;
+  for (size_t i = 0; i < phases.size(); ++i) {
+    ordered = ordered && phases[i] == (i % 2 ? LOOP_PHASE_CHECK
+                                              : LOOP_PHASE_PREPARE);
+  }
+  EXPECT_TRUE(ordered);
+} /*}}}*/
+
+TEST(Looper, priority) { /*{{{*/
+  // batches of one functor, a slice may take a whole lane at once
+  Looper looper(WORK_STEALING_SCHEDULER);
+  std::thread worker([&looper] { looper.loop(); });
+  std::atomic_bool gate(false), started(false);
+  looper.post([&] {
+    started = true;
+    while (!gate.load()) {
+      std::this_thread::yield();
+    }
+  });
+  while (!started.load()) {
+    std::this_thread::yield();
+  }
+
+  std::vector<PostPriority> order;
+  std::atomic_int done(0);
+  // enough bulk work for many batches so that aging kicks in
+  const int per_lane = 20, bulk = 1000;
+  for (auto priority : {PRIORITY_LOW, PRIORITY_NORMAL, PRIORITY_HIGH}) {
+    int count = priority == PRIORITY_NORMAL ? bulk : per_lane;
+    for (int i = 0; i < count; ++i) {
+      looper.post(priority, [&order, &done, priority] {
+        order.push_back(priority);
+        done.fetch_add(1);
+      });
+    }
+  }
+  EXPECT_EQ(static_cast<size_t>(per_lane), looper.lane_depth(PRIORITY_HIGH));
+  EXPECT_EQ(static_cast<size_t>(per_lane), looper.lane_depth(PRIORITY_LOW));
+  gate = true;
+  while (done.load() < 2 * per_lane + bulk) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+
+  // the high lane goes first, the low lane is not left for last
+  bool high_first = true;
+  for (int i = 0; i < per_lane; ++i) {
+    high_first = high_first && order[i] == PRIORITY_HIGH;
+  }
+  EXPECT_TRUE(high_first);
+  EXPECT_TRUE(order.back() != PRIORITY_LOW);
+  EXPECT_EQ(0u, looper.lane_depth(PRIORITY_NORMAL));
+} /*}}}*/
+
+TEST(Looper, capacity) { /*{{{*/
+  Looper looper;
+  std::thread worker([&looper] { looper.loop(); });
+  std::atomic_bool gate(false), started(false);
+  looper.post([&] {
+    started = true;
+    while (!gate.load()) {
+      std::this_thread::yield();
+    }
+  });
+  while (!started.load()) {
+    std::this_thread::yield();
+  }
+
+  std::atomic_int ran(0);
+  auto count = [&ran] { ran.fetch_add(1); };
+  looper.set_capacity(4);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_FALSE(looper.post(count));
+  }
+  EXPECT_EQ(LS_MISC_ERR_OBJ(queue_full), looper.post(count));
+  EXPECT_EQ(1u, looper.rejected_count());
+
+  // the lowest lane with work is shed first
+  looper.set_capacity(4, OVERFLOW_DROP_OLDEST);
+  EXPECT_FALSE(looper.post(PRIORITY_LOW, count));
+  EXPECT_EQ(1u, looper.dropped_count());
+  EXPECT_FALSE(looper.post(count));
+  EXPECT_EQ(2u, looper.dropped_count());
+
+  // strand capacity counts the functor being run
+  Strand &strand = looper.get_strand(1);
+  strand.set_capacity(2);
+  EXPECT_FALSE(strand.post(count));
+  EXPECT_FALSE(strand.post(count));
+  EXPECT_EQ(LS_MISC_ERR_OBJ(queue_full), strand.post(count));
+  EXPECT_EQ(1u, strand.rejected_count());
+  strand.set_capacity(2, OVERFLOW_DROP_OLDEST);
+  EXPECT_FALSE(strand.post(count));
+  EXPECT_EQ(1u, strand.dropped_count());
+
+  gate = true;
+  while (ran.load() < 6 || strand.size()) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+  // 4 unstranded, 2 of 3 posted to the strand
+  EXPECT_EQ(6, ran.load());
+} /*}}}*/
+
+TEST(Looper, unbounded) { /*{{{*/
+  Looper looper;
+  std::thread worker([&looper] { looper.loop(); });
+  std::atomic_bool gate(false), started(false);
+  looper.post([&] {
+    started = true;
+    while (!gate.load()) {
+      std::this_thread::yield();
+    }
+  });
+  while (!started.load()) {
+    std::this_thread::yield();
+  }
+
+  // past the limit, and the posts that shed the oldest pass them over
+  std::atomic_int kept(0), ran(0);
+  auto count = [&ran] { ran.fetch_add(1); };
+  looper.set_capacity(1, OVERFLOW_DROP_OLDEST);
+  looper.post_unbounded([&kept] { kept.fetch_add(1); });
+  EXPECT_FALSE(looper.post(count));
+  EXPECT_FALSE(looper.post(count));
+  EXPECT_EQ(1u, looper.dropped_count());
+
+  Strand &strand = looper.get_strand(1);
+  strand.set_capacity(1, OVERFLOW_DROP_OLDEST);
+  looper.strand_post_unbounded(strand, [&kept] { kept.fetch_add(1); });
+  EXPECT_FALSE(strand.post(count));
+  EXPECT_EQ(1u, strand.dropped_count());
+
+  gate = true;
+  while (kept.load() < 2 || ran.load() < 1 || strand.size()) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+  EXPECT_EQ(2, kept.load());
+  // one unstranded post was dropped, the strand dropped its plain post
+  EXPECT_EQ(1, ran.load());
+} /*}}}*/
+
+#ifdef HAVE_IO_URING
+TEST(Poller, io_uring) { /*{{{*/
+  Looper looper;
+  std::unique_ptr<IoUringPoller> poller;
+  try {
+    poller.reset(new IoUringPoller(looper));
+  } catch (const light::exception::EventException &) {
+    // kernel without io_uring, the looper runs on epoll
+    return;
+  }
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  Dispatcher dispatcher(looper, fds[0]);
+  dispatcher.enable_read();
+  EXPECT_FALSE(poller->add_dispatcher(dispatcher));
+
+  std::vector<Dispatcher *> active;
+  EXPECT_FALSE(poller->poll(0, active));
+  EXPECT_TRUE(active.empty());
+  char c = 'x';
+  ASSERT_EQ(1, ::write(fds[1], &c, 1));
+  EXPECT_FALSE(poller->poll(1000, active));
+  ASSERT_EQ(1u, active.size());
+  EXPECT_EQ(&dispatcher, active[0]);
+
+  // level triggered: unread data is reported again
+  active.clear();
+  EXPECT_FALSE(poller->poll(1000, active));
+  ASSERT_EQ(1u, active.size());
+  EXPECT_EQ(&dispatcher, active[0]);
+
+  ASSERT_EQ(1, ::read(fds[0], &c, 1));
+  dispatcher.disable_read();
+  dispatcher.enable_write();
+  EXPECT_FALSE(poller->update_dispatcher(dispatcher));
+  active.clear();
+  EXPECT_FALSE(poller->poll(1000, active));
+  ASSERT_EQ(1u, active.size());
+  EXPECT_EQ(&dispatcher, active[0]);
+
+  EXPECT_FALSE(poller->remove_dispatcher(dispatcher));
+  active.clear();
+  EXPECT_FALSE(poller->poll(0, active));
+  EXPECT_TRUE(active.empty());
+  // enable_read() attached it to the looper as well
+  dispatcher.detach();
+  ::close(fds[0]);
+  ::close(fds[1]);
+
+  // a poll that fails is reported once, not armed again in a loop
+  int closed[2];
+  ASSERT_EQ(0, ::pipe(closed));
+  ::close(closed[0]);
+  ::close(closed[1]);
+  Dispatcher broken(looper, closed[0]);
+  broken.enable_read();
+  EXPECT_FALSE(poller->add_dispatcher(broken));
+  active.clear();
+  EXPECT_FALSE(poller->poll(1000, active));
+  ASSERT_EQ(1u, active.size());
+  EXPECT_EQ(&broken, active[0]);
+  active.clear();
+  EXPECT_FALSE(poller->poll(0, active));
+  EXPECT_TRUE(active.empty());
+  EXPECT_FALSE(poller->remove_dispatcher(broken));
+  broken.detach();
+} /*}}}*/
+#endif
+
+TEST(TcpConnection, edge_triggered) { /*{{{*/
+  Looper looper;
+  if (!looper.edge_triggered_supported())
+    return;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  std::unique_ptr<TcpConnection> conn(new TcpConnection(looper, fds[0]));
+  EXPECT_FALSE(conn->set_edge_triggered());
+  std::thread worker([&looper] { looper.loop(); });
+
+  // sent before anybody reads, the edge is gone once the read starts
+  const char hello[] = "hello";
+  for (int i = 0; i < 3; ++i) {
+    ASSERT_EQ(5, ::write(fds[1], hello, 5));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  char rbuf[16] = {0};
+  std::atomic_bool read_done(false);
+  conn->async_read(rbuf, 15, [&read_done] { read_done = true; });
+  while (!read_done.load()) {
+    std::this_thread::yield();
+  }
+  EXPECT_EQ(std::string("hellohellohello"), std::string(rbuf, 15));
+
+  // more than the socket buffer, finished by EPOLLOUT edges
+  std::vector<char> wbuf(1 << 20, 'x');
+  std::atomic_bool write_done(false);
+  conn->async_write(&wbuf[0], wbuf.size(), [&write_done] { write_done = true; });
+  size_t received = 0;
+  char sink[65536];
+  while (received < wbuf.size()) {
+    ssize_t n = ::read(fds[1], sink, sizeof sink);
+    ASSERT_GT(n, 0);
+    received += n;
+  }
+  while (!write_done.load()) {
+    std::this_thread::yield();
+  }
+
+  ::shutdown(fds[1], SHUT_WR);
+  std::atomic_bool eof(false);
+  conn->async_read_some(rbuf, sizeof rbuf,
+                        [&eof](const std::error_code &ec, size_t) {
+                          eof = ec == LS_MISC_ERR_OBJ(eof);
+                        });
+  while (!eof.load()) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+  conn.reset();
+  ::close(fds[1]);
+} /*}}}*/
+
+TEST(TcpConnection, delete_with_drain_pending) { /*{{{*/
+  Looper looper;
+  if (!looper.edge_triggered_supported())
+    return;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  TcpConnection *conn = new TcpConnection(looper, fds[0]);
+  EXPECT_FALSE(conn->set_edge_triggered());
+
+  // the budget runs out with data left, the rest of the drain is posted
+  // and the connection is deleted ahead of it
+  char rbuf[16];
+  int calls = 0;
+  std::atomic_bool done(false);
+  std::function<void(const std::error_code &, size_t)> on_read =
+      [&](const std::error_code &ec, size_t) {
+        if (ec)
+          return;
+        if (++calls == TcpConnection::EDGE_BUDGET) {
+          looper.post(PRIORITY_HIGH, [&] {
+            delete conn;
+            looper.post([&done] { done = true; });
+          });
+        }
+        conn->async_read_some(rbuf, sizeof rbuf, on_read);
+      };
+  conn->async_read_some(rbuf, sizeof rbuf, on_read);
+  std::thread worker([&looper] { looper.loop(); });
+  std::vector<char> data(sizeof rbuf * TcpConnection::EDGE_BUDGET * 4, 'x');
+  ASSERT_EQ(static_cast<ssize_t>(data.size()),
+            ::write(fds[1], &data[0], data.size()));
+  while (!done.load()) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+  EXPECT_EQ(TcpConnection::EDGE_BUDGET, calls);
+  ::close(fds[1]);
+} /*}}}*/
+
+TEST(Looper, oneshot) { /*{{{*/
+  Looper looper;
+  if (looper.set_oneshot_dispatch(true))
+    return;
+  int slow[2], fast[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, slow));
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fast));
+  Dispatcher slow_disp(looper, slow[0]), fast_disp(looper, fast[0]);
+  std::atomic_int inside(0), most(0), consumed(0);
+  std::atomic_bool slow_started(false), fast_seen(false), timed_out(false);
+  slow_disp.set_read_callback([&] {
+    int now = inside.fetch_add(1) + 1;
+    if (now > most.load())
+      most = now;
+    slow_started = true;
+    // the fd stays readable meanwhile, it must not be handed out again but
+    // the other one must still be polled
+    auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!fast_seen.load()) {
+      if (std::chrono::steady_clock::now() > deadline) {
+        timed_out = true;
+        break;
+      }
+      std::this_thread::yield();
+    }
+    char c;
+    if (::read(slow[0], &c, 1) == 1)
+      consumed.fetch_add(1);
+    inside.fetch_sub(1);
+  });
+  fast_disp.set_read_callback([&] {
+    char c;
+    if (::read(fast[0], &c, 1) == 1)
+      fast_seen = true;
+  });
+  slow_disp.enable_read();
+  fast_disp.enable_read();
+  EXPECT_TRUE(slow_disp.oneshot());
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 4; ++i) {
+    workers.emplace_back([&looper] { looper.loop(); });
+  }
+  const char data[4] = {0};
+  ASSERT_EQ(4, ::write(slow[1], data, sizeof data));
+  while (!slow_started.load()) {
+    std::this_thread::yield();
+  }
+  ASSERT_EQ(1, ::write(fast[1], data, 1));
+  while (consumed.load() < 4) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  for (auto &thd : workers) {
+    thd.join();
+  }
+  EXPECT_FALSE(timed_out.load());
+  EXPECT_EQ(1, most.load());
+  slow_disp.detach();
+  fast_disp.detach();
+  for (int fd : {slow[0], slow[1], fast[0], fast[1]}) {
+    ::close(fd);
+  }
+} /*}}}*/
+
+#ifdef HAVE_EPOLL_H
+TEST(Poller, epoll_batch) { /*{{{*/
+  Looper looper;
+  EpollPoller poller(looper);
+  const int count = 100;
+  std::vector<int> fds(2 * count);
+  std::vector<std::unique_ptr<Dispatcher>> dispatchers;
+  for (int i = 0; i < count; ++i) {
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[2 * i]));
+    ASSERT_EQ(1, ::write(fds[2 * i + 1], "x", 1));
+    dispatchers.emplace_back(new Dispatcher(looper, fds[2 * i]));
+    dispatchers.back()->enable_read();
+    EXPECT_FALSE(poller.add_dispatcher(*dispatchers.back()));
+  }
+
+  // level triggered: every poll sees all of them once the array is large
+  std::vector<Dispatcher *> active;
+  for (int i = 0; i < 4; ++i) {
+    active.clear();
+    EXPECT_FALSE(poller.poll(0, active));
+  }
+  EXPECT_EQ(static_cast<size_t>(count), active.size());
+  EXPECT_GT(poller.event_capacity(), static_cast<size_t>(count));
+
+  for (auto &dispatcher : dispatchers) {
+    EXPECT_FALSE(poller.remove_dispatcher(*dispatcher));
+    dispatcher->detach();
+  }
+  for (int fd : fds) {
+    ::close(fd);
+  }
+} /*}}}*/
+#endif
+
+TEST(Poller, dispatcher_table) { /*{{{*/
+  Looper looper;
+  Dispatcher first(looper, 3), second(looper, 700);
+  DispatcherTable table;
+  EXPECT_EQ(nullptr, table.find(3));
+  EXPECT_EQ(nullptr, table.find(-1));
+
+  uint32_t generation = table.insert(first);
+  table.insert(second);
+  EXPECT_EQ(2u, table.size());
+  EXPECT_EQ(&first, table.find(3));
+  EXPECT_EQ(&first, table.find(3, generation));
+  EXPECT_EQ(&second, table.find(700));
+
+  // the fd is closed and reused, events tagged before are stale
+  uint64_t tag = DispatcherTable::tag(3, generation);
+  table.erase(3);
+  EXPECT_EQ(nullptr, table.find(3));
+  Dispatcher reused(looper, 3);
+  EXPECT_NE(generation, table.insert(reused));
+  EXPECT_EQ(nullptr, table.find(DispatcherTable::tag_fd(tag),
+                                DispatcherTable::tag_generation(tag)));
+  EXPECT_EQ(&reused, table.find(3));
+  EXPECT_EQ(2u, table.size());
+} /*}}}*/
+
+TEST(Looper, oneshot_overflow) { /*{{{*/
+  Looper looper;
+  if (looper.set_oneshot_dispatch(true))
+    return;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+  Dispatcher disp(looper, fds[0]);
+  std::atomic_int consumed(0);
+  // a byte per event, the dispatcher is re-armed over and over
+  disp.set_read_callback([&] {
+    char c;
+    if (::read(fds[0], &c, 1) == 1)
+      consumed.fetch_add(1);
+  });
+  disp.enable_read();
+  EXPECT_TRUE(disp.oneshot());
+  looper.set_capacity(2, OVERFLOW_DROP_OLDEST);
+  // right after every poll, a dropped poll result would leave the
+  // dispatcher disarmed for good
+  looper.add_loop_hook(LOOP_PHASE_CHECK, [&looper] {
+    for (int i = 0; i < 4; ++i) {
+      looper.post([] {});
+    }
+  });
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < 2; ++i) {
+    workers.emplace_back([&looper] { looper.loop(); });
+  }
+  const char data[20] = {0};
+  ASSERT_EQ(20, ::write(fds[1], data, sizeof data));
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  while (consumed.load() < 20 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  for (auto &thd : workers) {
+    thd.join();
+  }
+  EXPECT_EQ(20, consumed.load());
+  EXPECT_LT(0u, looper.dropped_count());
+  disp.detach();
+  ::close(fds[0]);
+  ::close(fds[1]);
+} /*}}}*/
+
+TEST(Looper, coalesced_updates) { /*{{{*/
+  Looper looper;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  Dispatcher dispatcher(looper, fds[0]);
+  dispatcher.enable_read();
+  uint64_t updates = looper.update_count();
+  // the poller already has it
+  dispatcher.enable_read();
+  EXPECT_EQ(updates, looper.update_count());
+
+  std::thread worker([&looper] { looper.loop(); });
+  std::atomic_int done(0);
+  looper.post([&] {
+    // flips within one batch cancel out
+    dispatcher.enable_write();
+    dispatcher.disable_write();
+    done.fetch_add(1);
+  });
+  looper.post([&] {
+    dispatcher.enable_write();
+    dispatcher.disable_read();
+    dispatcher.enable_read();
+    done.fetch_add(1);
+  });
+  while (done.load() < 2) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+  EXPECT_TRUE(dispatcher.writable());
+  EXPECT_EQ(1u, looper.update_count() - updates);
+
+  dispatcher.detach();
+  ::close(fds[0]);
+  ::close(fds[1]);
+} /*}}}*/
+
+TEST(Looper, cancel_update_from_thread) { /*{{{*/
+  Looper looper;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  Dispatcher *dispatcher = new Dispatcher(looper, fds[0]);
+  dispatcher->enable_read();
+  uint64_t updates = looper.update_count();
+
+  std::thread worker([&looper] { looper.loop(); });
+  std::atomic_bool queued(false), deleted(false);
+  looper.post([&] {
+    // queued until this functor returns, deleted meanwhile on another thread
+    dispatcher->enable_write();
+    queued = true;
+    while (!deleted.load()) {
+      std::this_thread::yield();
+    }
+  });
+  while (!queued.load()) {
+    std::this_thread::yield();
+  }
+  delete dispatcher;
+  deleted = true;
+  std::atomic_bool done(false);
+  looper.post([&done] { done = true; });
+  while (!done.load()) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+  // removed from the poller, the queued update never made
+  EXPECT_EQ(updates, looper.update_count());
+  ::close(fds[0]);
+  ::close(fds[1]);
+} /*}}}*/
+
+TEST(Dispatcher, single_pass) { /*{{{*/
+  Looper looper;
+  std::unique_ptr<Poller> poller(Poller::create_default_poller(looper));
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  Dispatcher dispatcher(looper, fds[0]);
+  std::vector<std::string> calls;
+  dispatcher.set_read_callback([&] {
+    char buf[16];
+    ::read(fds[0], buf, sizeof buf);
+    calls.push_back("read");
+  });
+  dispatcher.set_write_callback([&] { calls.push_back("write"); });
+  dispatcher.set_half_close_callback([&] { calls.push_back("half_close"); });
+  dispatcher.enable_all();
+  // readable and writable: both callbacks in one dispatch, read first
+  ASSERT_EQ(1, ::write(fds[1], "x", 1));
+  EXPECT_FALSE(poller->add_dispatcher(dispatcher));
+  std::vector<Dispatcher *> active;
+  EXPECT_FALSE(poller->poll(1000, active));
+  ASSERT_EQ(1u, active.size());
+  active[0]->handle_events();
+  ASSERT_EQ(2u, calls.size());
+  EXPECT_EQ("read", calls[0]);
+  EXPECT_EQ("write", calls[1]);
+
+  // the peer's shutdown is reported once, after the read that sees it
+  ASSERT_EQ(0, ::shutdown(fds[1], SHUT_WR));
+  for (int i = 0; i < 2; ++i) {
+    calls.clear();
+    active.clear();
+    EXPECT_FALSE(poller->poll(1000, active));
+    ASSERT_EQ(1u, active.size());
+    active[0]->handle_events();
+    ASSERT_EQ(i ? 2u : 3u, calls.size());
+    EXPECT_EQ("read", calls.front());
+    EXPECT_EQ("write", calls.back());
+    if (i == 0) {
+      EXPECT_EQ("half_close", calls[1]);
+    }
+  }
+
+  EXPECT_FALSE(poller->remove_dispatcher(dispatcher));
+  ::close(fds[0]);
+  ::close(fds[1]);
+} /*}}}*/
+
+TEST(TimerQueue, wheel) { /*{{{*/
+  TimerQueue queue;
+  Timestamp base = light::utils::get_monotonic_timestamp();
+  bool need_update;
+  EXPECT_EQ(0u, queue.next_expiry());
+
+  // spread over every level and beyond, some of them cancelled
+  std::mt19937_64 rng(7);
+  const int count = 3000;
+  std::vector<Timestamp> expires(count);
+  std::vector<Timestamp> fired(count, 0);
+  std::vector<TimerId> ids(count);
+  std::vector<bool> cancelled(count, false);
+  Timestamp now = base;
+  for (int i = 0; i < count; ++i) {
+    Timestamp delay = rng() % (i % 3 ? 300000ULL : 40000000000ULL);
+    if (i % 500 == 1)
+      delay += 5000000000000ULL;
+    expires[i] = base + delay;
+    ids[i] = queue.add_timer_at(expires[i], 0, need_update,
+                                [i, &fired, &now] { fired[i] = now; });
+  }
+  for (int i = 0; i < count; i += 7) {
+    queue.del_timer(ids[i], need_update);
+    cancelled[i] = true;
+  }
+  Timestamp next = queue.next_expiry();
+  for (int i = 0; i < count; ++i) {
+    if (!cancelled[i]) {
+      EXPECT_TRUE(next <= expires[i] + TimerQueue::TICK_US);
+    }
+  }
+
+  while (queue.size()) {
+    now += rng() % (now - base < 1000000 ? 5000 : 2000000000ULL);
+    queue.update_time(now);
+    for (int i = 0; i < count; ++i) {
+      if (cancelled[i]) {
+        EXPECT_EQ(0u, fired[i]);
+      } else if (fired[i]) {
+        EXPECT_TRUE(expires[i] <= fired[i]);
+      } else {
+        // due timers all went off
+        EXPECT_TRUE(now < expires[i] + TimerQueue::TICK_US);
+      }
+    }
+  }
+
+  // repeating, cancelled from its own callback
+  int repeats = 0;
+  TimerId repeating = queue.add_timer_at(
+      now + 10000, 10000, need_update, [&] {
+        if (++repeats == 5)
+          queue.del_timer(repeating, need_update);
+      });
+  for (int i = 0; i < 200; ++i) {
+    now += 1000;
+    queue.update_time(now);
+  }
+  EXPECT_EQ(5, repeats);
+  EXPECT_EQ(0u, queue.size());
+  EXPECT_EQ(0u, queue.next_expiry());
+} /*}}}*/
+
+TEST(TimerQueue, slack) { /*{{{*/
+  TimerQueue queue;
+  Timestamp base = light::utils::get_monotonic_timestamp();
+  const Timestamp slack = 50000;
+  std::vector<Timestamp> due, fired;
+  std::set<Timestamp> wakeups;
+  bool need_update;
+  Timestamp now = base;
+  for (int i = 0; i < 200; ++i) {
+    // falling deadlines would move the head on every add without slack
+    Timestamp when = base + 300000 - i * 997;
+    due.push_back(when);
+    fired.push_back(0);
+    queue.add_timer_at(when, 0, need_update,
+                       [&fired, &now, i] { fired[i] = now; }, slack);
+    wakeups.insert(queue.next_expiry());
+  }
+  EXPECT_TRUE(wakeups.size() < 10);
+
+  while (queue.size()) {
+    Timestamp next = queue.next_expiry();
+    EXPECT_TRUE(next > now);
+    now = next;
+    queue.update_time(now);
+  }
+  for (size_t i = 0; i < due.size(); ++i) {
+    EXPECT_TRUE(fired[i] >= due[i]);
+    EXPECT_TRUE(fired[i] <= due[i] + slack);
+  }
+} /*}}}*/
+
+TEST(Looper, timer_slack) { /*{{{*/
+  Looper looper;
+  std::thread worker([&looper] { looper.loop(); });
+  std::error_code ec;
+  uint64_t exact = 0, coalesced = 0;
+  std::atomic_bool done(false);
+  // the loop thread adds in place, one timerfd update per moved head
+  looper.post([&] {
+    std::vector<TimerId> ids;
+    uint64_t before = looper.timerfd_update_count();
+    for (int i = 0; i < 100; ++i) {
+      // inside the root wheel, every add moves the head
+      ids.push_back(looper.add_timer(ec, 200000 - i * 1000, 0, [] {}));
+    }
+    exact = looper.timerfd_update_count() - before;
+    for (TimerId id : ids) {
+      looper.cancel_timer(ec, id);
+    }
+
+    looper.set_timer_slack(50000);
+    before = looper.timerfd_update_count();
+    for (int i = 0; i < 100; ++i) {
+      looper.add_timer(ec, 200000 - i * 1000, 0, [] {});
+    }
+    coalesced = looper.timerfd_update_count() - before;
+    done = true;
+  });
+  while (!done.load()) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+#ifdef HAVE_TIMERFD
+  EXPECT_TRUE(exact >= 90);
+  EXPECT_TRUE(coalesced < 10);
+#endif
+  EXPECT_FALSE(ec);
+} /*}}}*/
+
+TEST(Looper, now) { /*{{{*/
+  Looper looper;
+  std::thread worker([&looper] { looper.loop(); });
+  std::atomic<Timestamp> seen(0);
+  std::error_code ec;
+  Timestamp added = light::utils::get_monotonic_timestamp();
+  looper.add_timer(ec, 20000, 0, [&] { seen = looper.now(); });
+  EXPECT_FALSE(ec);
+  while (!seen.load()) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+  // the timer fired off the cached time, which is never before its expiry
+  EXPECT_TRUE(seen.load() >= added + 20000);
+  EXPECT_TRUE(looper.now() >= seen.load());
+  Timestamp coarse = Looper::coarse_now();
+  Timestamp fine = light::utils::get_monotonic_timestamp();
+  EXPECT_TRUE(coarse <= fine + 1000);
+  EXPECT_TRUE(fine - coarse < 100000);
+} /*}}}*/
+
+TEST(Deadlines, refresh) { /*{{{*/
+  Looper looper;
+  Deadlines deadlines(looper, 1000);
+  deadlines.set_timeout(Deadlines::IDLE, 30000);
+  Deadlines::Entry busy, quiet;
+  std::vector<Deadlines::Type> busy_fired, quiet_fired;
+  deadlines.attach(busy, [&busy_fired](Deadlines::Type type) {
+    busy_fired.push_back(type);
+  });
+  deadlines.attach(quiet, [&quiet_fired](Deadlines::Type type) {
+    quiet_fired.push_back(type);
+  });
+  // a type without timeout never runs
+  deadlines.refresh(busy, Deadlines::READ);
+  EXPECT_FALSE(deadlines.running(busy, Deadlines::READ));
+
+  std::atomic<Timestamp> started(0), expired(0);
+  looper.post([&] {
+    busy.refresh(Deadlines::IDLE);
+    quiet.refresh(Deadlines::IDLE);
+    started = looper.now();
+  });
+  std::error_code ec;
+  auto keep_alive = looper.add_timer(ec, 5000, 5000, [&] {
+    busy.refresh(Deadlines::IDLE);
+    if (!quiet_fired.empty() && !expired.load())
+      expired = looper.now();
+  });
+  std::thread worker([&looper] { looper.loop(); });
+  while (!expired.load()) {
+    std::this_thread::yield();
+  }
+  looper.post([&] { looper.cancel_timer(ec, keep_alive); });
+  looper.stop();
+  worker.join();
+
+  EXPECT_EQ(1u, quiet_fired.size());
+  EXPECT_EQ(Deadlines::IDLE, quiet_fired[0]);
+  EXPECT_TRUE(expired.load() >= started.load() + 30000);
+  EXPECT_TRUE(busy_fired.empty());
+  EXPECT_TRUE(deadlines.running(busy, Deadlines::IDLE));
+  EXPECT_FALSE(deadlines.running(quiet, Deadlines::IDLE));
+  EXPECT_EQ(1u, deadlines.size());
+  deadlines.detach(busy);
+  EXPECT_EQ(0u, deadlines.size());
+  EXPECT_FALSE(busy.attached());
+  EXPECT_TRUE(quiet.attached());
+} /*}}}*/
+
+TEST(TcpConnection, deadlines) { /*{{{*/
+  Looper looper;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  std::unique_ptr<TcpConnection> conn(new TcpConnection(looper, fds[0]));
+  Deadlines deadlines(looper, 1000);
+  deadlines.set_timeout(Deadlines::READ, 60000);
+  deadlines.set_timeout(Deadlines::WRITE, 40000);
+  std::mutex lock;
+  std::vector<std::pair<Deadlines::Type, Timestamp>> fired;
+  char rbuf[16];
+  std::function<void()> read_next = [&] {
+    conn->async_read_some(rbuf, sizeof rbuf,
+                          [&](const std::error_code &ec, size_t) {
+                            if (!ec)
+                              read_next();
+                          });
+  };
+  looper.post([&] {
+    conn->set_deadlines(deadlines, [&](Deadlines::Type type) {
+      std::lock_guard<std::mutex> lk(lock);
+      fired.emplace_back(type, light::utils::get_monotonic_timestamp());
+    });
+    read_next();
+  });
+  std::thread worker([&looper] { looper.loop(); });
+  auto wait_fired = [&](size_t count) {
+    for (int i = 0; i < 2000; ++i) {
+      {
+        std::lock_guard<std::mutex> lk(lock);
+        if (fired.size() >= count)
+          return;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  };
+
+  // data every 10ms keeps the read deadline from running out
+  Timestamp last_data = 0;
+  for (int i = 0; i < 12; ++i) {
+    ASSERT_EQ(1, ::write(fds[1], "x", 1));
+    last_data = light::utils::get_monotonic_timestamp();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  wait_fired(1);
+
+  // nobody reads the other end, the write buffer stays queued
+  std::vector<char> wbuf(4 << 20, 'x');
+  Timestamp write_start = light::utils::get_monotonic_timestamp();
+  looper.post([&] { conn->async_write(&wbuf[0], wbuf.size(), [] {}); });
+  wait_fired(2);
+  looper.stop();
+  worker.join();
+
+  ASSERT_EQ(2u, fired.size());
+  EXPECT_EQ(Deadlines::READ, fired[0].first);
+  EXPECT_TRUE(fired[0].second >= last_data + 60000);
+  EXPECT_EQ(Deadlines::WRITE, fired[1].first);
+  EXPECT_TRUE(fired[1].second >= write_start + 40000);
+  conn->close();
+  EXPECT_EQ(0u, deadlines.size());
+  ::close(fds[1]);
+} /*}}}*/
+
+TEST(TimerQueue, generation) { /*{{{*/
+  TimerQueue queue;
+  Timestamp now = light::utils::get_monotonic_timestamp();
+  bool need_update;
+  int first = 0, second = 0;
+  TimerId old_id =
+      queue.add_timer_at(now + 1000, 0, need_update, [&first] { ++first; });
+  now += 2000;
+  queue.update_time(now);
+  EXPECT_EQ(1, first);
+
+  // the released slot comes back with a new generation
+  TimerId new_id =
+      queue.add_timer_at(now + 1000, 0, need_update, [&second] { ++second; });
+  EXPECT_EQ(static_cast<uint32_t>(old_id), static_cast<uint32_t>(new_id));
+  EXPECT_NE(old_id, new_id);
+  queue.del_timer(old_id, need_update);
+  EXPECT_EQ(1u, queue.size());
+  now += 2000;
+  queue.update_time(now);
+  EXPECT_EQ(1, second);
+  EXPECT_EQ(0u, queue.size());
+  // cancelling a fired timer does nothing either
+  queue.del_timer(new_id, need_update);
+  EXPECT_EQ(0u, queue.size());
+} /*}}}*/
+
+TEST(Looper, timers_from_threads) { /*{{{*/
+  Looper looper;
+  std::thread worker([&looper] { looper.loop(); });
+  const int THREADS = 4, TIMERS = 500;
+  std::atomic_int fired(0), cancelled_fired(0);
+  std::vector<std::thread> producers;
+  for (int t = 0; t < THREADS; ++t) {
+    producers.emplace_back([&, t] {
+      std::error_code ec;
+      std::mt19937 rng(t);
+      for (int i = 0; i < TIMERS; ++i) {
+        bool cancel = i % 2;
+        TimerId id = looper.add_timer(ec, 1000 + rng() % 20000, 0,
+                                      [&fired, &cancelled_fired, cancel] {
+                                        ++(cancel ? cancelled_fired : fired);
+                                      });
+        EXPECT_FALSE(ec);
+        if (cancel)
+          looper.cancel_timer(ec, id);
+      }
+    });
+  }
+  for (auto &producer : producers) {
+    producer.join();
+  }
+  while (fired.load() < THREADS * TIMERS / 2) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  // cancels racing with the expiry of an id that was reused meanwhile
+  std::atomic_int repeats(0);
+  std::error_code ec;
+  TimerId stale = looper.add_timer(ec, 1000, 0, [] {});
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  TimerId repeating =
+      looper.add_timer(ec, 1000, 1000, [&repeats] { ++repeats; });
+  looper.cancel_timer(ec, stale);
+  while (repeats.load() < 3) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  looper.cancel_timer(ec, repeating);
+  looper.stop();
+  worker.join();
+  EXPECT_EQ(THREADS * TIMERS / 2, fired.load());
+  EXPECT_EQ(0, cancelled_fired.load());
+} /*}}}*/
+
+TEST(TcpConnection, start_reading) { /*{{{*/
+  for (int edge = 0; edge < 2; ++edge) {
+    Looper looper;
+    if (edge && !looper.edge_triggered_supported())
+      break;
+    int fds[2];
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    std::unique_ptr<TcpConnection> conn(new TcpConnection(looper, fds[0]));
+    if (edge) {
+      EXPECT_FALSE(conn->set_edge_triggered());
+    }
+    std::thread worker([&looper] { looper.loop(); });
+
+    // sent before the reading starts, an edge would be gone by then
+    const size_t total = 1 << 20;
+    std::vector<char> wbuf(total);
+    for (size_t i = 0; i < total; ++i) {
+      wbuf[i] = static_cast<char>(i * 7);
+    }
+    ASSERT_EQ(1000, ::write(fds[1], &wbuf[0], 1000));
+
+    std::vector<char> received;
+    int calls = 0;
+    std::atomic_bool done(false);
+    std::error_code last_ec;
+    looper.post([&] {
+      conn->start_reading([&](const std::error_code &ec, ReadBuffer &buf) {
+        ++calls;
+        if (ec) {
+          last_ec = ec;
+          done = true;
+          // the handler may delete the connection, itself included
+          conn.reset();
+          return;
+        }
+        // whole 1000 byte frames only, a partial one waits in the ring
+        size_t frames = buf.size() / 1000 * 1000;
+        if (received.size() + buf.size() == total)
+          frames = buf.size();
+        if (!frames)
+          return;
+        const char *data = buf.peek(frames);
+        received.insert(received.end(), data, data + frames);
+        buf.consume(frames);
+      });
+    });
+    size_t sent = 1000;
+    while (sent < total) {
+      ssize_t n = ::write(fds[1], &wbuf[sent], total - sent);
+      ASSERT_GT(n, 0);
+      sent += n;
+    }
+    ::shutdown(fds[1], SHUT_WR);
+    while (!done.load()) {
+      std::this_thread::yield();
+    }
+    looper.stop();
+    worker.join();
+
+    EXPECT_EQ(LS_MISC_ERR_OBJ(eof), last_ec);
+    EXPECT_TRUE(received == wbuf);
+    EXPECT_FALSE(conn);
+    // chunks as big as the buffer, not one call per small read
+    EXPECT_TRUE(calls <= static_cast<int>(total / 64));
+    ::close(fds[1]);
+  }
+} /*}}}*/
+
+TEST(TcpConnection, start_reading_chunks) { /*{{{*/
+  for (int edge = 0; edge < 2; ++edge) {
+    Looper looper;
+    if (edge && !looper.edge_triggered_supported())
+      break;
+    int fds[2];
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    std::unique_ptr<TcpConnection> conn(new TcpConnection(looper, fds[0]));
+    if (edge) {
+      EXPECT_FALSE(conn->set_edge_triggered());
+    }
+    std::thread worker([&looper] { looper.loop(); });
+
+    const size_t total = 1 << 16;
+    const size_t chunk_len = 1000;
+    std::vector<char> wbuf(total);
+    for (size_t i = 0; i < total; ++i) {
+      wbuf[i] = static_cast<char>(i * 7);
+    }
+    std::vector<char> received;
+    int allocated = 0;
+    int freed = 0;
+    bool oversized = false;
+    std::atomic_bool done(false);
+    std::error_code last_ec;
+    looper.post([&] {
+      conn->start_reading(
+          chunk_len,
+          [&] {
+            ++allocated;
+            return new char[chunk_len];
+          },
+          [&](char *chunk) {
+            ++freed;
+            delete[] chunk;
+          },
+          [&](const std::error_code &ec, char *chunk, size_t size) {
+            if (ec) {
+              last_ec = ec;
+              EXPECT_FALSE(chunk);
+              done = true;
+              // releases the chunk kept for the next read
+              conn.reset();
+              return;
+            }
+            // the bytes were read into the chunk, no copy in between
+            oversized |= size > chunk_len;
+            received.insert(received.end(), chunk, chunk + size);
+            ++freed;
+            delete[] chunk;
+          });
+    });
+    size_t sent = 0;
+    while (sent < total) {
+      ssize_t n = ::write(fds[1], &wbuf[sent], total - sent);
+      ASSERT_GT(n, 0);
+      sent += n;
+    }
+    ::shutdown(fds[1], SHUT_WR);
+    while (!done.load()) {
+      std::this_thread::yield();
+    }
+    looper.stop();
+    worker.join();
+
+    EXPECT_EQ(LS_MISC_ERR_OBJ(eof), last_ec);
+    EXPECT_TRUE(received == wbuf);
+    EXPECT_FALSE(oversized);
+    EXPECT_EQ(allocated, freed);
+    ::close(fds[1]);
+  }
+} /*}}}*/
+
+TEST(TcpConnection, delete_with_stream_pending) { /*{{{*/
+  Looper looper;
+  if (!looper.edge_triggered_supported())
+    return;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds));
+  int sndbuf = 1 << 20;
+  ::setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof sndbuf);
+  TcpConnection *conn = new TcpConnection(looper, fds[0]);
+  EXPECT_FALSE(conn->set_edge_triggered());
+
+  // more than EDGE_BUDGET reads of a whole ring each
+  std::vector<char> data(1 << 16, 'x');
+  size_t prefilled = 0;
+  while (true) {
+    ssize_t n = ::write(fds[1], &data[0], data.size());
+    if (n <= 0)
+      break;
+    prefilled += n;
+  }
+  ASSERT_GT(prefilled, static_cast<size_t>(TcpConnection::EDGE_BUDGET *
+                                           TcpConnection::STREAM_BUFFER_SIZE));
+
+  // the budget runs out with data left, the rest of the drain is posted
+  // and the connection is deleted ahead of it
+  int calls = 0;
+  std::atomic_bool done(false);
+  conn->start_reading([&](const std::error_code &ec, ReadBuffer &buf) {
+    if (ec)
+      return;
+    buf.consume(buf.size());
+    if (++calls == TcpConnection::EDGE_BUDGET) {
+      looper.post(PRIORITY_HIGH, [&] {
+        delete conn;
+        looper.post([&done] { done = true; });
+      });
+    }
+  });
+  std::thread worker([&looper] { looper.loop(); });
+  while (!done.load()) {
+    std::this_thread::yield();
+  }
+  looper.stop();
+  worker.join();
+  EXPECT_EQ(TcpConnection::EDGE_BUDGET, calls);
+  ::close(fds[1]);
+} /*}}}*/
+
+TEST(ReadBuffer, ring) { /*{{{*/
+  ReadBuffer buf(16);
+  EXPECT_EQ(0u, buf.capacity());
+  struct iovec iov[2];
+  ASSERT_EQ(1, buf.prepare(iov, 4));
+  EXPECT_EQ(16u, buf.capacity());
+  ::memcpy(iov[0].iov_base, "0123456789abcdef", 16);
+  buf.commit(16);
+  buf.consume(10);
+
+  // the data reaches the end, the free space is the front
+  ASSERT_EQ(1, buf.prepare(iov, 4));
+  EXPECT_EQ(10u, iov[0].iov_len);
+  ::memcpy(iov[0].iov_base, "ghij", 4);
+  buf.commit(4);
+  ASSERT_EQ(2, buf.data(iov));
+  EXPECT_EQ(6u, iov[0].iov_len);
+  EXPECT_EQ(4u, iov[1].iov_len);
+  EXPECT_EQ(std::string("abcdefghij"), std::string(buf.peek(10), 10));
+  ASSERT_EQ(1, buf.data(iov));
+
+  // grows keeping the order, and shrinks back when it drained
+  ASSERT_EQ(1, buf.prepare(iov, 64));
+  EXPECT_EQ(128u, buf.capacity());
+  ::memset(iov[0].iov_base, 'x', 64);
+  buf.commit(64);
+  EXPECT_EQ(std::string("abcdefghijxx"), std::string(buf.peek(12), 12));
+  buf.consume(74);
+  buf.trim();
+  EXPECT_EQ(128u, buf.capacity());
+  ASSERT_EQ(1, buf.prepare(iov, 1));
+  buf.commit(1);
+  buf.consume(1);
+  buf.trim();
+  EXPECT_EQ(16u, buf.capacity());
+
+  // the free space wraps: the tail and the front, one readv fills both
+  ASSERT_EQ(1, buf.prepare(iov, 4));
+  buf.commit(12);
+  buf.consume(8);
+  ASSERT_EQ(2, buf.prepare(iov, 4));
+  EXPECT_EQ(4u, iov[0].iov_len);
+  EXPECT_EQ(8u, iov[1].iov_len);
+} /*}}}*/
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+#include <memory>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <thread>
+#include <vector>
+#include "utils/lockfree_queue.h"
+#include "utils/task.h"
+#include "utils/thread_placement.h"
+
+using namespace light::utils;
+
+TEST(LockFreeQueue, mpsc) { /*{{{*/
+  const int producers = 4;
+  const int per_producer = 10000;
+  LockFreeQueue<int> queue;
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&queue, p, per_producer] {
+      for (int i = 0; i < per_producer; ++i) {
+        queue.push_back(p * per_producer + i);
+      }
+    });
+  }
+
+  std::vector<int> last(producers, -1);
+  int count = 0;
+  int value;
+  while (count < producers * per_producer) {
+    if (!queue.pop_front(value))
+      continue;
+    ++count;
+    // fifo per producer
+    EXPECT_LT(last[value / per_producer], value % per_producer);
+    last[value / per_producer] = value % per_producer;
+  }
+  for (auto &thd : threads) {
+    thd.join();
+  }
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(queue.pop_front(value));
+
+  LockFreeQueue<int> bounded(2);
+  EXPECT_TRUE(bounded.try_push_back(1));
+  EXPECT_TRUE(bounded.try_push_back(2));
+  EXPECT_FALSE(bounded.try_push_back(3));
+  EXPECT_TRUE(bounded.pop_front());
+  EXPECT_TRUE(bounded.try_push_back(3));
+} /*}}}*/
+
+TEST(Task, move_only) { /*{{{*/
+  struct Counter {
+    void add(std::unique_ptr<int> value, int times) { sum += *value * times; }
+    int sum = 0;
+  };
+  Counter counter;
+  Task task =
+      make_task(&Counter::add, &counter, std::unique_ptr<int>(new int(3)), 2);
+  EXPECT_TRUE(static_cast<bool>(task));
+
+  // moving the task moves the bound unique_ptr along
+  Task moved(std::move(task));
+  EXPECT_FALSE(static_cast<bool>(task));
+  moved();
+  EXPECT_EQ(6, counter.sum);
+
+  std::shared_ptr<int> alive(new int(0));
+  {
+    Task holder([alive] { ++*alive; });
+    EXPECT_EQ(2, alive.use_count());
+    holder();
+  }
+  EXPECT_EQ(1, *alive);
+  EXPECT_EQ(1, alive.use_count());
+
+  struct Big {
+    char data[Task::INLINE_SIZE * 2];
+    void operator()() { data[0] = 1; }
+  };
+  EXPECT_FALSE(Task::is_inline<Big>::value);
+  Task big((Big()));
+  big();
+} /*}}}*/
+
+TEST(ThreadPlacement, cpus) { /*{{{*/
+  const CpuTopology &topology = CpuTopology::get();
+  EXPECT_TRUE(topology.node_count() > 0);
+
+  int node;
+  ThreadPlacement pin(ThreadPlacement::PIN_CORE);
+  auto cpus = pin.cpus_for(0, node);
+  EXPECT_EQ(1, static_cast<int>(cpus.size()));
+  EXPECT_EQ(topology.node_of_cpu(cpus[0]), node);
+#ifdef __linux__
+  // under taskset or a cpuset only the allowed cpus are handed out
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  ASSERT_EQ(0, ::sched_getaffinity(0, sizeof allowed, &allowed));
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_TRUE(CPU_ISSET(pin.cpus_for(i, node)[0], &allowed));
+  }
+#endif
+
+  ThreadPlacement spread(ThreadPlacement::SPREAD_NUMA);
+  cpus = spread.cpus_for(1, node);
+  EXPECT_FALSE(cpus.empty());
+  for (int cpu : cpus) {
+    EXPECT_EQ(node, topology.node_of_cpu(cpu));
+  }
+
+  // an excluded cpu is never handed out, unless it is the only one
+  pin.excluded_cpus.push_back(cpus[0]);
+  for (int i = 0; i < 8; ++i) {
+    auto pinned = pin.cpus_for(i, node);
+    EXPECT_TRUE(pinned.empty() || pinned[0] != cpus[0]);
+  }
+
+  std::error_code ec;
+  std::thread thd([&ec] {
+    ec = ThreadPlacement(ThreadPlacement::PIN_CORE).apply(0);
+  });
+  thd.join();
+  EXPECT_FALSE(ec);
+} /*}}}*/